@@ -0,0 +1,43 @@
+TEMPLATE = app
+TARGET = bench
+
+CONFIG += \
+    c++11 \
+    console \
+
+QT = \
+    core \
+
+DEFINES += \
+    QT_FORCE_ASSERTS \
+    QT_NO_SIGNALS_SLOTS_KEYWORDS \ # Conflicts with PA where slots is used as a variable name.
+
+PRE_TARGETDEPS += \
+    ../webrtc/libwebrtc.a
+
+LIBS += \
+    -L$${OUT_PWD}/../webrtc -lwebrtc \
+
+INCLUDEPATH += \
+    .. \
+    ../webrtc \
+
+HEADERS += \
+
+SOURCES += \
+    main.cpp \
+    pa_sink_stub.cpp \
+    ../flight_recorder.cpp \
+    ../sample_ops.cpp \
+    ../stats.cpp \
+    ../thread_config.cpp \
+    ../trace.cpp \
+    ../writer_base.cpp \
+
+include(../third_party.pri)
+include(../webrtc/webrtc.pri)
+
+# The harness runs outside the daemon, so the pulsecore helpers used by the
+# writers must be linked explicitly.
+LIBS += \
+    -L$${PULSEAUDIO_BASE}/src/.libs -lpulsecore-$${PULSEAUDIO_VERSION} \
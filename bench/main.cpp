@@ -0,0 +1,222 @@
+// Offline benchmark harness for the writer stack.
+//
+// Feeds synthetic PCM through PAAudioDeviceModule::write() (the same path
+// the delivery thread takes in production) at faster-than-real-time rates
+// and reports per-block latency percentiles and throughput, without
+// needing a running PulseAudio daemon. Intended for catching performance
+// regressions in CI.
+//
+// Usage: bench [seconds-of-audio] [pcm-file]
+//   seconds-of-audio  How much audio to push through the stack (default 60).
+//   pcm-file          Optional raw S16LE file to play instead of the
+//                     synthetic sine.
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include <QtCore/QByteArray>
+#include <QtCore/QCoreApplication>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QFile>
+#include <QtCore/QTextStream>
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+#include <webrtc/base/scoped_ref_ptr.h>
+#pragma GCC diagnostic pop
+
+#include "pa_audio_device_module.h"
+#include "pa_sink.h"
+#include "spsc_ring_buffer.h"
+
+namespace {
+const int kDefaultSeconds = 60;
+const int kBlockMsec = 10;
+} // namespace
+
+// Swallows the delivered audio like the voice engine would.
+class CountingTransport : public webrtc::AudioTransport {
+public:
+    CountingTransport()
+        : m_delivered_blocks(0)
+    {
+    }
+
+    uint64_t deliveredBlocks() const {
+        return m_delivered_blocks;
+    }
+
+    int32_t RecordedDataIsAvailable(const void *audioSamples,
+                                    const uint32_t nSamples,
+                                    const uint8_t nBytesPerSample,
+                                    const uint8_t nChannels,
+                                    const uint32_t samplesPerSec,
+                                    const uint32_t totalDelayMS,
+                                    const int32_t clockDrift,
+                                    const uint32_t currentMicLevel,
+                                    const bool keyPressed,
+                                    uint32_t &newMicLevel) override {
+        Q_UNUSED(audioSamples);
+        Q_UNUSED(nSamples);
+        Q_UNUSED(nBytesPerSample);
+        Q_UNUSED(nChannels);
+        Q_UNUSED(samplesPerSec);
+        Q_UNUSED(totalDelayMS);
+        Q_UNUSED(clockDrift);
+        Q_UNUSED(currentMicLevel);
+        Q_UNUSED(keyPressed);
+        newMicLevel = currentMicLevel;
+        ++m_delivered_blocks;
+        return 0;
+    }
+
+    int32_t NeedMorePlayData(const uint32_t nSamples,
+                             const uint8_t nBytesPerSample,
+                             const uint8_t nChannels,
+                             const uint32_t samplesPerSec,
+                             void *audioSamples,
+                             uint32_t &nSamplesOut,
+                             int64_t *elapsed_time_ms,
+                             int64_t *ntp_time_ms) override {
+        Q_UNUSED(nSamples);
+        Q_UNUSED(nBytesPerSample);
+        Q_UNUSED(nChannels);
+        Q_UNUSED(samplesPerSec);
+        Q_UNUSED(audioSamples);
+        Q_UNUSED(elapsed_time_ms);
+        Q_UNUSED(ntp_time_ms);
+        nSamplesOut = 0;
+        return 0;
+    }
+
+private:
+    uint64_t m_delivered_blocks;
+};
+
+static qint64 percentile(std::vector<qint64> &sorted, double p) {
+    size_t index = (size_t)(p * (sorted.size() - 1));
+    return sorted[index];
+}
+
+static void report(QTextStream &out, const char *name,
+                   std::vector<qint64> &ns_per_block, size_t block_bytes,
+                   qint64 total_ns) {
+    std::sort(ns_per_block.begin(), ns_per_block.end());
+
+    double seconds = total_ns / 1e9;
+    double mb = ns_per_block.size() * block_bytes / (1024.0 * 1024.0);
+
+    out << name << ":\n";
+    out << "  blocks:     " << (qint64)ns_per_block.size() << "\n";
+    out << "  p50:        " << percentile(ns_per_block, 0.50) << " ns\n";
+    out << "  p90:        " << percentile(ns_per_block, 0.90) << " ns\n";
+    out << "  p99:        " << percentile(ns_per_block, 0.99) << " ns\n";
+    out << "  max:        " << ns_per_block.back() << " ns\n";
+    out << "  throughput: " << mb / seconds << " MiB/s\n";
+}
+
+int main(int argc, char *argv[]) {
+    QCoreApplication app(argc, argv);
+    QTextStream out(stdout);
+
+    int seconds = kDefaultSeconds;
+    if (argc > 1) {
+        // toInt() turns garbage into 0, and zero seconds would leave the
+        // sample vectors empty and the percentile math undefined.
+        seconds = QByteArray(argv[1]).toInt();
+        if (seconds < 1) {
+            out << "Usage: " << argv[0] << " [seconds] [input.pcm]\n";
+            out << "seconds must be a positive integer.\n";
+            return 1;
+        }
+    }
+
+    PASink *pa_sink = &PASink::instance();
+    const size_t block_bytes = pa_sink->sampleRateHz() * 2 *
+            pa_sink->numChannels() * kBlockMsec / 1000;
+    const int num_blocks = seconds * 1000 / kBlockMsec;
+
+    // Prepares the input: recorded PCM if given, a sine otherwise.
+    QByteArray input;
+    if (argc > 2) {
+        QFile file(argv[2]);
+        if (!file.open(QIODevice::ReadOnly)) {
+            out << "Could not open " << argv[2] << "\n";
+            return 1;
+        }
+        input = file.readAll();
+    }
+    if ((size_t)input.size() < block_bytes) {
+        input.resize(block_bytes);
+        int16_t *samples = (int16_t *)input.data();
+        size_t num_samples = block_bytes / 2;
+        for (size_t i = 0; i < num_samples; ++i) {
+            samples[i] = (int16_t)(10000 * sin(i * 0.05));
+        }
+    }
+    const int input_blocks = input.size() / block_bytes;
+
+    // Benchmarks the SPSC hand-off ring on its own.
+    {
+        SpscRingBuffer ring(64 * block_bytes);
+        QByteArray scratch(block_bytes, 0);
+        std::vector<qint64> latencies;
+        latencies.reserve(num_blocks);
+
+        QElapsedTimer total;
+        total.start();
+        QElapsedTimer timer;
+        for (int i = 0; i < num_blocks; ++i) {
+            timer.start();
+            ring.write(input.constData(), block_bytes);
+            ring.read(scratch.data(), block_bytes);
+            latencies.push_back(timer.nsecsElapsed());
+        }
+        report(out, "spsc_ring (write+read)", latencies, block_bytes,
+               total.nsecsElapsed());
+    }
+
+    // Benchmarks the ADM delivery path: staging buffer, SetRecordedBuffer
+    // and DeliverRecordedData into a swallowing transport.
+    {
+        rtc::scoped_refptr<webrtc::PAAudioDeviceModule> adm(
+                    new rtc::RefCountedObject<webrtc::PAAudioDeviceModule>(
+                        pa_sink));
+        CountingTransport transport;
+
+        adm->Init();
+        adm->RegisterAudioCallback(&transport);
+        adm->SetStereoRecording(pa_sink->numChannels() == 2);
+        adm->InitRecording();
+        adm->StartRecording();
+
+        std::vector<qint64> latencies;
+        latencies.reserve(num_blocks);
+
+        QElapsedTimer total;
+        total.start();
+        QElapsedTimer timer;
+        for (int i = 0; i < num_blocks; ++i) {
+            const char *block =
+                    input.constData() + (i % input_blocks) * block_bytes;
+            timer.start();
+            adm->write(block, block_bytes);
+            latencies.push_back(timer.nsecsElapsed());
+        }
+        qint64 total_ns = total.nsecsElapsed();
+
+        adm->StopRecording();
+        adm->Terminate();
+
+        report(out, "adm write+deliver", latencies, block_bytes, total_ns);
+        out << "  delivered:  " << (qint64)transport.deliveredBlocks()
+            << " blocks\n";
+
+        double audio_seconds = num_blocks * kBlockMsec / 1000.0;
+        out << "  speed:      " << audio_seconds / (total_ns / 1e9)
+            << "x real time\n";
+    }
+
+    return 0;
+}
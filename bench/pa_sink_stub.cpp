@@ -0,0 +1,75 @@
+// Stand-in for pa_sink.cpp in the benchmark harness: provides the PASink
+// surface the writers consult without requiring a running PulseAudio
+// daemon. Linked instead of the real implementation.
+
+#include "pa_sink.h"
+
+// Only referenced through the QScopedPointer member; never instantiated.
+class PASinkPriv {
+};
+
+namespace {
+const int kSampleRateHz = 48000;
+const int kBitRateBps   = 128000;
+const int kNumChannels  = 2;
+
+// PA_VOLUME_NORM and friends, spelled out to keep the stub free of pulse
+// includes.
+const quint32 kVolumeNorm = 0x10000U;
+} // namespace
+
+PASink::PASink()
+    : d(NULL)
+{
+}
+
+PASink::~PASink() {
+}
+
+QScopedPointer<PASink> PASink::m_instance(NULL);
+PASink &PASink::instance() {
+    if (!m_instance) {
+        m_instance.reset(new PASink);
+    }
+
+    return *m_instance;
+}
+void PASink::drop() {
+    m_instance.reset(NULL);
+}
+
+int PASink::init(pa_module *module, Writer *writer) {
+    Q_UNUSED(module);
+    Q_UNUSED(writer);
+    return 0;
+}
+
+int PASink::sampleRateHz() const {
+    return kSampleRateHz;
+}
+int PASink::bitRateBps() const {
+    return kBitRateBps;
+}
+void PASink::setBitRateBps(int bit_rate_bps) {
+    Q_UNUSED(bit_rate_bps);
+}
+int PASink::numChannels() const {
+    return kNumChannels;
+}
+
+bool PASink::isMuted() const {
+    return false;
+}
+
+quint32 PASink::volume() const {
+    return kVolumeNorm;
+}
+quint32 PASink::minVolume() const {
+    return 0;
+}
+quint32 PASink::maxVolume() const {
+    return kVolumeNorm;
+}
+quint16 PASink::volumeStepSize() const {
+    return kVolumeNorm / 256;
+}
@@ -10,13 +10,20 @@ class ControlServer : public QObject {
 public:
     virtual ~ControlServer() {}
 
+    // Broadcasts the message to all connected clients (or queues it until
+    // one connects).
     virtual void sendMessage(const QString &type, const QJsonValue &payload) =0;
 
+    // Sends the message to one specific client.
+    virtual void sendMessage(quintptr client_id, const QString &type,
+                             const QJsonValue &payload) =0;
+
 Q_SIGNALS:
-    void clientConnected();
-    void clientDisconnected();
+    void clientConnected(quintptr client_id);
+    void clientDisconnected(quintptr client_id);
 
-    void messageReceived(const QString &type, const QJsonValue &payload);
+    void messageReceived(quintptr client_id, const QString &type,
+                         const QJsonValue &payload);
 };
 
 #endif // CONTROL_SERVER
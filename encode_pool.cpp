@@ -0,0 +1,117 @@
+#include "encode_pool.h"
+
+#include <QtCore/QByteArray>
+#include <QtCore/QMutex>
+#include <QtCore/QMutexLocker>
+#include <QtCore/QThread>
+
+#include "thread_config.h"
+
+// One pool thread with its own job queue. The queue is a plain mutexed
+// list: the jobs are whole encode batches, so the per-job locking cost is
+// noise next to the work itself.
+class EncodePoolWorker : public QThread {
+public:
+    EncodePoolWorker(EncodePool *pool, int index)
+        : m_pool(pool)
+        , m_index(index)
+    {
+    }
+
+    void push(const std::function<void()> &job) {
+        QMutexLocker l(&m_mutex);
+        m_jobs.append(job);
+    }
+
+    // Takes the oldest own job (FIFO keeps peers from starving).
+    std::function<void()> takeOwn() {
+        QMutexLocker l(&m_mutex);
+        if (m_jobs.isEmpty()) {
+            return std::function<void()>();
+        }
+        return m_jobs.takeFirst();
+    }
+
+    // Steals the newest job; stealing from the opposite end keeps the
+    // owner and the thief off the same entries.
+    std::function<void()> steal() {
+        QMutexLocker l(&m_mutex);
+        if (m_jobs.isEmpty()) {
+            return std::function<void()>();
+        }
+        return m_jobs.takeLast();
+    }
+
+protected:
+    void run() override {
+        QByteArray name = "pacc-encode-" + QByteArray::number(m_index);
+        thread_config::applyToCurrentThread(name.constData());
+
+        for (;;) {
+            m_pool->m_available.acquire();
+            if (m_pool->m_stopping.load(std::memory_order_acquire)) {
+                break;
+            }
+
+            std::function<void()> job = m_pool->takeJob(m_index);
+            if (job) {
+                job();
+            }
+        }
+    }
+
+private:
+    EncodePool *m_pool;
+    int m_index;
+
+    QMutex m_mutex;
+    QList<std::function<void()> > m_jobs;
+};
+
+
+EncodePool::EncodePool(int num_threads)
+    : m_next(0)
+    , m_stopping(false)
+{
+    for (int i = 0; i < num_threads; ++i) {
+        EncodePoolWorker *worker = new EncodePoolWorker(this, i);
+        m_workers.append(worker);
+        worker->start();
+    }
+}
+
+EncodePool::~EncodePool() {
+    m_stopping.store(true, std::memory_order_release);
+    m_available.release(m_workers.size());
+
+    foreach (EncodePoolWorker *worker, m_workers) {
+        worker->wait();
+        delete worker;
+    }
+}
+
+int EncodePool::numThreads() const {
+    return m_workers.size();
+}
+
+void EncodePool::post(const std::function<void()> &job) {
+    uint32_t index = m_next.fetch_add(1, std::memory_order_relaxed);
+    m_workers[index % m_workers.size()]->push(job);
+    m_available.release();
+}
+
+std::function<void()> EncodePool::takeJob(int worker_index) {
+    std::function<void()> job = m_workers[worker_index]->takeOwn();
+    if (job) {
+        return job;
+    }
+
+    for (int i = 1; i < m_workers.size(); ++i) {
+        job = m_workers[(worker_index + i) % m_workers.size()]->steal();
+        if (job) {
+            return job;
+        }
+    }
+
+    return std::function<void()>();
+}
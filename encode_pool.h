@@ -0,0 +1,50 @@
+#ifndef ENCODE_POOL_H
+#define ENCODE_POOL_H
+
+#include <atomic>
+#include <functional>
+
+#include <QtCore/QList>
+#include <QtCore/QSemaphore>
+#include <QtCore/QtGlobal>
+
+class EncodePoolWorker;
+
+// A small work-stealing thread pool for the encode stage.
+//
+// Jobs are posted round-robin onto per-worker queues; a woken worker
+// drains its own queue first and steals from its siblings when it runs
+// dry, so an uneven job mix (one slow peer, several fast ones) still keeps
+// every core busy. Jobs run in arbitrary order relative to each other;
+// serializing work that must stay ordered is the caller's business (see
+// the per-peer scheduling in writer_opus.cpp).
+class EncodePool {
+public:
+    explicit EncodePool(int num_threads);
+    ~EncodePool();
+
+    int numThreads() const;
+
+    // Enqueues a job for execution on some pool worker. Never blocks.
+    void post(const std::function<void()> &job);
+
+private:
+    Q_DISABLE_COPY(EncodePool)
+
+    friend class EncodePoolWorker;
+
+    // Returns the next job for the given worker: its own queue first, then
+    // a steal from the siblings. Empty when there is nothing to do.
+    std::function<void()> takeJob(int worker_index);
+
+    QList<EncodePoolWorker *> m_workers;
+
+    // One release per posted job; all workers acquire from it, so exactly
+    // one worker wakes per job no matter whose queue it landed in.
+    QSemaphore m_available;
+
+    std::atomic<uint32_t> m_next;
+    std::atomic<bool> m_stopping;
+};
+
+#endif // ENCODE_POOL_H
@@ -0,0 +1,160 @@
+#include "flight_recorder.h"
+
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <QtCore/QDebug>
+#include <QtCore/QFile>
+
+// The on-disk layout. The write position grows monotonically and is masked
+// with the capacity on access, exactly like the in-memory rings; underruns
+// and last_underrun_pos are stamped by noteUnderrun().
+struct FlightRecorderHeader {
+    char magic[8];
+    quint32 sample_rate;
+    quint8 num_channels;
+    quint8 bytes_per_sample;
+    quint16 reserved;
+    quint64 capacity;
+    quint64 write_pos;
+    quint64 underruns;
+    quint64 last_underrun_pos;
+} __attribute__((packed));
+
+namespace {
+// Bumped whenever FlightRecorderHeader changes.
+const char kMagic[8] = {'P', 'A', 'C', 'C', 'F', 'R', '0', '1'};
+} // namespace
+
+FlightRecorder::FlightRecorder(const QString &path, size_t capacity,
+                               quint32 sample_rate, quint8 num_channels,
+                               quint8 bytes_per_sample)
+    : m_path(path)
+    , m_fd(-1)
+    , m_base(NULL)
+    , m_map_size(sizeof(FlightRecorderHeader) + capacity)
+    , m_header(NULL)
+    , m_ring(NULL)
+    , m_capacity(capacity)
+{
+    m_fd = ::open(QFile::encodeName(path).constData(),
+                  O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (m_fd < 0) {
+        qWarning() << "Could not open the flight recorder file" << path;
+        return;
+    }
+
+    if (::ftruncate(m_fd, m_map_size) != 0) {
+        qWarning() << "Could not size the flight recorder file" << path;
+        ::close(m_fd);
+        m_fd = -1;
+        return;
+    }
+
+    void *base = ::mmap(NULL, m_map_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED, m_fd, 0);
+    if (base == MAP_FAILED) {
+        qWarning() << "Could not map the flight recorder file" << path;
+        ::close(m_fd);
+        m_fd = -1;
+        return;
+    }
+
+    m_base = (char *)base;
+    m_header = (FlightRecorderHeader *)m_base;
+    m_ring = m_base + sizeof(FlightRecorderHeader);
+
+    memcpy(m_header->magic, kMagic, sizeof(kMagic));
+    m_header->sample_rate = sample_rate;
+    m_header->num_channels = num_channels;
+    m_header->bytes_per_sample = bytes_per_sample;
+    m_header->reserved = 0;
+    m_header->capacity = capacity;
+    m_header->write_pos = 0;
+    m_header->underruns = 0;
+    m_header->last_underrun_pos = 0;
+}
+
+FlightRecorder::~FlightRecorder() {
+    if (m_base) {
+        // Asks the kernel to schedule the writeback; no need to wait for it.
+        ::msync(m_base, m_map_size, MS_ASYNC);
+        ::munmap(m_base, m_map_size);
+    }
+    if (m_fd >= 0) {
+        ::close(m_fd);
+    }
+}
+
+bool FlightRecorder::isOpen() const {
+    return m_header != NULL;
+}
+
+QString FlightRecorder::path() const {
+    return m_path;
+}
+
+void FlightRecorder::write(const void *buf, size_t length) {
+    if (!m_header) {
+        return;
+    }
+    if (length > m_capacity) {
+        // Only the newest capacity bytes can survive anyway.
+        buf = (const char *)buf + (length - m_capacity);
+        length = m_capacity;
+    }
+
+    size_t offset = m_header->write_pos % m_capacity;
+    size_t tail = m_capacity - offset;
+    if (length <= tail) {
+        memcpy(m_ring + offset, buf, length);
+    } else {
+        memcpy(m_ring + offset, buf, tail);
+        memcpy(m_ring, (const char *)buf + tail, length - tail);
+    }
+    m_header->write_pos += length;
+}
+
+void FlightRecorder::noteUnderrun() {
+    if (!m_header) {
+        return;
+    }
+    ++m_header->underruns;
+    m_header->last_underrun_pos = m_header->write_pos;
+}
+
+bool FlightRecorder::snapshot(const QString &dest_path) const {
+    if (!m_header) {
+        return false;
+    }
+
+    QFile dest(dest_path);
+    if (!dest.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qWarning() << "Could not open the snapshot file" << dest_path;
+        return false;
+    }
+
+    // The snapshot is linear: its write position equals its capacity, so
+    // readers need no unwrapping.
+    const quint64 write_pos = m_header->write_pos;
+    const quint64 filled = qMin<quint64>(write_pos, m_capacity);
+
+    FlightRecorderHeader header = *m_header;
+    header.capacity = filled;
+    header.write_pos = filled;
+    dest.write((const char *)&header, sizeof(header));
+
+    size_t offset = (write_pos - filled) % m_capacity;
+    size_t tail = m_capacity - offset;
+    if (filled <= tail) {
+        dest.write(m_ring + offset, filled);
+    } else {
+        dest.write(m_ring + offset, tail);
+        dest.write(m_ring, filled - tail);
+    }
+
+    return dest.flush();
+}
@@ -0,0 +1,64 @@
+#ifndef FLIGHT_RECORDER_H
+#define FLIGHT_RECORDER_H
+
+#include <cstddef>
+
+#include <QtCore/QString>
+#include <QtCore/QtGlobal>
+
+struct FlightRecorderHeader;
+
+// Always-on flight recording for raw PCM.
+//
+// The audio is written into a fixed-size memory-mapped ring file: the hot
+// path does plain stores into the mapping and the kernel writes the dirty
+// pages back on its own schedule, so recording costs neither syscalls nor
+// buffered I/O on the delivery thread. The file permanently holds the most
+// recent capacity bytes; when something goes wrong the last N seconds can
+// be snapshotted after the fact instead of having had recording enabled
+// up front.
+//
+// The file starts with a small self-describing header (sample spec, ring
+// capacity, write position, underrun marks) so offline tools can unwrap
+// the ring and locate the glitch without extra context.
+class FlightRecorder {
+public:
+    // Creates (truncating) and maps the ring file. isOpen() tells whether
+    // that worked; a recorder that failed to open swallows all writes.
+    FlightRecorder(const QString &path, size_t capacity,
+                   quint32 sample_rate, quint8 num_channels,
+                   quint8 bytes_per_sample);
+    ~FlightRecorder();
+
+    bool isOpen() const;
+
+    // The path of the ring file, as given to the constructor.
+    QString path() const;
+
+    // Appends to the ring, overwriting the oldest audio. Must only be
+    // called from one thread; does no syscalls and never blocks.
+    void write(const void *buf, size_t length);
+
+    // Stamps the current write position into the header so offline tools
+    // can locate the audio around the underrun. As cheap as write().
+    void noteUnderrun();
+
+    // Writes a linearized (oldest-to-newest) copy of the ring to
+    // dest_path. Meant for the control plane; a write racing the copy can
+    // tear at most the newest block.
+    bool snapshot(const QString &dest_path) const;
+
+private:
+    Q_DISABLE_COPY(FlightRecorder)
+
+    QString m_path;
+    int m_fd;
+    char *m_base;
+    size_t m_map_size;
+
+    FlightRecorderHeader *m_header;
+    char *m_ring;
+    size_t m_capacity;
+};
+
+#endif // FLIGHT_RECORDER_H
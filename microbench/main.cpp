@@ -0,0 +1,217 @@
+// Microbenchmarks for the module's core primitives.
+//
+// Complements the end-to-end harness in ../bench: where that one measures
+// the whole delivery path, this target times each primitive on its own —
+// the circular staging copy, the SPSC hand-off ring, the volume and
+// format-conversion kernels, the control-channel JSON serialization and
+// the seqlock state reads — and reports ns/op and bytes/op across block
+// sizes from 2.5 ms to 100 ms. An optimization of any of these is
+// accepted or rejected against the numbers printed here.
+//
+// Usage: microbench
+
+#include <cmath>
+#include <cstring>
+
+#include <QtCore/QByteArray>
+#include <QtCore/QCoreApplication>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QJsonDocument>
+#include <QtCore/QJsonObject>
+#include <QtCore/QString>
+#include <QtCore/QTextStream>
+
+#include "sample_ops.h"
+#include "sink_state.h"
+#include "spsc_ring_buffer.h"
+
+namespace {
+// The sample spec the module runs with in production.
+const int kSampleRateHz = 48000;
+const int kNumChannels = 2;
+
+// Block durations the pipeline realistically handles, from the smallest
+// client chunks to large slices of the block budget.
+const double kBlockMsecs[] = {2.5, 5, 10, 20, 50, 100};
+
+// Wall time spent per measurement. Long enough to amortize the timer and
+// to let the frequency governor settle.
+const qint64 kTargetNsec = 200000000;
+
+// Swallows results so the compiler cannot elide the measured work.
+volatile quint64 g_sink = 0;
+} // namespace
+
+// Runs op batches until kTargetNsec is spent and prints one result line.
+// inner is the number of logical operations one op() call performs;
+// bytes_per_op refers to a single logical operation.
+template<typename Op>
+static void run(QTextStream &out, const QString &name, size_t bytes_per_op,
+                qint64 inner, Op op) {
+    op(); // Warm-up: faults the pages in and primes the caches.
+
+    QElapsedTimer timer;
+    timer.start();
+    qint64 batches = 0;
+    do {
+        op();
+        ++batches;
+    } while (timer.nsecsElapsed() < kTargetNsec);
+    const qint64 elapsed_nsec = timer.nsecsElapsed();
+    const double ns_per_op = (double)elapsed_nsec / (batches * inner);
+
+    out << name.leftJustified(40) << QString::number(ns_per_op, 'f', 1)
+               .rightJustified(12) << " ns/op"
+        << QString::number((qulonglong)bytes_per_op).rightJustified(10)
+        << " bytes/op";
+    if (bytes_per_op > 0) {
+        double mib_per_sec = bytes_per_op / (ns_per_op / 1e9) /
+                (1024.0 * 1024.0);
+        out << QString::number(mib_per_sec, 'f', 0).rightJustified(10)
+            << " MiB/s";
+    }
+    out << "\n";
+}
+
+static QString blockName(const char *prefix, double msec) {
+    return QString("%1 (%2 ms)").arg(prefix).arg(msec);
+}
+
+int main(int argc, char *argv[]) {
+    QCoreApplication app(argc, argv);
+    QTextStream out(stdout);
+
+    for (size_t b = 0; b < sizeof(kBlockMsecs) / sizeof(kBlockMsecs[0]);
+         ++b) {
+        const double msec = kBlockMsecs[b];
+        const size_t num_samples =
+                (size_t)(kSampleRateHz * kNumChannels * msec / 1000);
+        const size_t s16_bytes = num_samples * sizeof(int16_t);
+        const size_t float_bytes = num_samples * sizeof(float);
+
+        QByteArray s16_buf(s16_bytes, 0);
+        QByteArray float_buf(float_bytes, 0);
+        QByteArray scratch(qMax(s16_bytes, float_bytes), 0);
+        int16_t *s16 = (int16_t *)s16_buf.data();
+        float *flt = (float *)float_buf.data();
+        for (size_t i = 0; i < num_samples; ++i) {
+            s16[i] = (int16_t)(10000 * sin(i * 0.05));
+            flt[i] = (float)(0.3 * sin(i * 0.05));
+        }
+
+        // The circular copy-in strategy of PAAudioDeviceModule::write:
+        // split memcpy into a preallocated staging ring, contiguous 10 ms
+        // blocks consumed on the far side.
+        {
+            const size_t block_size = kSampleRateHz * kNumChannels * 2 / 100;
+            QByteArray staging(100 * block_size, 0);
+            size_t read = 0;
+            size_t filled = 0;
+            run(out, blockName("staging copy", msec), s16_bytes, 1, [&]() {
+                const size_t capacity = (size_t)staging.size();
+                size_t fit = qMin(s16_bytes, capacity - filled);
+                size_t write_pos = (read + filled) % capacity;
+                size_t tail = capacity - write_pos;
+                if (fit <= tail) {
+                    memcpy(staging.data() + write_pos, s16_buf.constData(),
+                           fit);
+                } else {
+                    memcpy(staging.data() + write_pos, s16_buf.constData(),
+                           tail);
+                    memcpy(staging.data(), s16_buf.constData() + tail,
+                           fit - tail);
+                }
+                filled += fit;
+
+                while (filled >= block_size) {
+                    g_sink += (quint64)(quint8)staging.at((int)read);
+                    read = (read + block_size) % capacity;
+                    filled -= block_size;
+                }
+            });
+        }
+
+        // The lock-free hand-off ring, one producer write plus one
+        // consumer read per operation.
+        {
+            SpscRingBuffer ring(64 * s16_bytes);
+            run(out, blockName("spsc ring write+read", msec), s16_bytes, 1,
+                [&]() {
+                    ring.write(s16_buf.constData(), s16_bytes);
+                    g_sink += ring.read(scratch.data(), s16_bytes);
+                });
+        }
+
+        // The volume and format-conversion kernels (see sample_ops).
+        run(out, blockName("scaleS16", msec), s16_bytes, 1, [&]() {
+            sample_ops::scaleS16((int16_t *)scratch.data(), num_samples,
+                                 0x6000);
+        });
+        run(out, blockName("scaleFloat", msec), float_bytes, 1, [&]() {
+            sample_ops::scaleFloat(flt, num_samples, 0.99f);
+        });
+        run(out, blockName("floatToS16", msec), float_bytes, 1, [&]() {
+            sample_ops::floatToS16(flt, (int16_t *)scratch.data(),
+                                   num_samples);
+        });
+        run(out, blockName("s16ToFloat", msec), s16_bytes, 1, [&]() {
+            sample_ops::s16ToFloat(s16, (float *)scratch.data(),
+                                   num_samples);
+        });
+
+        // isSilence on an all-zero block is the worst case: the scan
+        // cannot bail out early.
+        {
+            QByteArray zeros(s16_bytes, 0);
+            run(out, blockName("isSilence (silent)", msec), s16_bytes, 1,
+                [&]() {
+                    g_sink += sample_ops::isSilence(zeros.constData(),
+                                                    s16_bytes);
+                });
+        }
+
+        out << "\n";
+    }
+
+    // The control-channel serialization: what WebsocketServer::sendMessage
+    // does per message (makeMessage + serializeMessage), measured with a
+    // typical signaling payload.
+    {
+        QJsonObject payload;
+        payload["sdpMid"] = "audio";
+        payload["sdpMLineIndex"] = 0;
+        payload["candidate"] =
+                "candidate:2999745851 1 udp 2122260223 192.168.1.10 57065 "
+                "typ host generation 0";
+        size_t bytes = 0;
+        run(out, "sendMessage serialization", 0, 1, [&]() {
+            QJsonObject message;
+            message["type"] = "addIceCandidate";
+            message["payload"] = payload;
+            QJsonDocument document(message);
+            QString serialized = QString::fromUtf8(document.toJson());
+            bytes = (size_t)serialized.size();
+            g_sink += bytes;
+        });
+        out << "  (message size: " << (qulonglong)bytes << " bytes)\n";
+    }
+
+    // The seqlock state read every hot path performs per block (see
+    // SinkStateSeqlock::read). Batched: one timer check per 1024 reads.
+    {
+        SinkStateSeqlock state;
+        state.update([](SinkState *value) {
+            value->volume = 0x10000;
+            value->sample_rate_hz = kSampleRateHz;
+            value->num_channels = kNumChannels;
+            value->bit_rate_bps = 128000;
+        });
+        run(out, "seqlock read", sizeof(SinkState), 1024, [&]() {
+            for (int i = 0; i < 1024; ++i) {
+                g_sink += state.read().volume;
+            }
+        });
+    }
+
+    return 0;
+}
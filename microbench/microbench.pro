@@ -0,0 +1,23 @@
+TEMPLATE = app
+TARGET = microbench
+
+CONFIG += \
+    c++11 \
+    console \
+
+QT = \
+    core \
+
+DEFINES += \
+    QT_FORCE_ASSERTS \
+
+INCLUDEPATH += \
+    .. \
+
+HEADERS += \
+
+SOURCES += \
+    main.cpp \
+    ../sample_ops.cpp \
+
+include(../third_party.pri)
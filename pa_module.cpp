@@ -2,12 +2,22 @@
 
 extern "C" {
 #include <config.h>
+#include <pulsecore/modargs.h>
 #include <pulsecore/module.h>
 #include <pulsecore/thread.h>
 } // extern "C"
 
+#include <sched.h>
+
+#include <cstdlib>
+
+#include <QtCore/QStringList>
+
 #include "pa_sink.h"
+#include "thread_config.h"
 #include "websocket_server.h"
+#include "writer_http.h"
+#include "writer_opus.h"
 #include "writer_webrtc.h"
 
 PA_MODULE_AUTHOR("Sämy Zehnder");
@@ -17,6 +27,52 @@ PA_MODULE_LOAD_ONCE(true);
 
 namespace {
 const int kControlServerPort = 51348;
+
+// Defaults for the direct Opus/RTP writer (writer=opus).
+const char kDefaultRtpHost[] = "127.0.0.1";
+const uint32_t kDefaultRtpPort = 46464;
+
+// Default port of the HTTP/ICY stream writer (writer=http).
+const uint32_t kDefaultHttpPort = 46465;
+
+// Reads the rt_priority/rt_fifo/cpu_affinity module arguments and publishes
+// them for the worker threads. This happens before those threads start so
+// they can configure themselves right away; the sink keeps its own rtpoll
+// treatment. cpu_affinity is a comma-separated CPU list, e.g. "2,3".
+void configureThreads(pa_module *m) {
+    pa_modargs *ma = pa_modargs_new(m->argument, PASink::validModargs());
+    if (!ma) {
+        // PASinkPriv::init reports the parse error later.
+        return;
+    }
+
+    uint32_t rt_priority = 0;
+    pa_modargs_get_value_u32(ma, "rt_priority", &rt_priority);
+
+    bool rt_fifo = false;
+    pa_modargs_get_value_boolean(ma, "rt_fifo", &rt_fifo);
+
+    uint64_t cpu_mask = 0;
+    const char *affinity = pa_modargs_get_value(ma, "cpu_affinity", NULL);
+    while (affinity && *affinity) {
+        char *end = NULL;
+        long cpu = strtol(affinity, &end, 10);
+        if (end == affinity || cpu < 0 || cpu >= 64) {
+            pa_log("Invalid cpu_affinity argument.");
+            cpu_mask = 0;
+            break;
+        }
+        cpu_mask |= (uint64_t)1 << cpu;
+        affinity = (*end == ',') ? end + 1 : end;
+    }
+
+    if (rt_priority > 0 || cpu_mask != 0) {
+        thread_config::configure(rt_fifo ? SCHED_FIFO : SCHED_RR,
+                                 (int)rt_priority, cpu_mask);
+    }
+
+    pa_modargs_free(ma);
+}
 } // namespace
 
 extern "C" {
@@ -69,18 +125,64 @@ void PAModule::exec() {
     int argc = 0;
     QCoreApplication app(argc, NULL);
 
-    // Initializes the control server.
+    // Creates the control server. Its constructor only records the port;
+    // the expensive part (certificate I/O, TLS setup, listen) is deferred
+    // below so the sink becomes available first.
     m_control_server.reset(new WebsocketServer(kControlServerPort));
 
+    // Publishes the thread scheduling configuration before any worker
+    // thread starts.
+    configureThreads(m_module);
+
     // Creates the sink.
     PASink *pa_sink = &PASink::instance();
 
-    // Initializes the writer.
-    m_writer.reset(new WebRTCWriter(pa_sink, m_control_server.data()));
+    // Initializes the writer. writer=opus selects the direct Opus/RTP
+    // writer, writer=http the chunked HTTP/ICY stream; the default remains
+    // the full WebRTC stack.
+    QString writer_kind = "webrtc";
+    QString rtp_host = kDefaultRtpHost;
+    uint32_t rtp_port = kDefaultRtpPort;
+    uint32_t http_port = kDefaultHttpPort;
+    pa_modargs *ma = pa_modargs_new(m_module->argument,
+                                    PASink::validModargs());
+    if (ma) {
+        writer_kind = pa_modargs_get_value(ma, "writer", "webrtc");
+        rtp_host = pa_modargs_get_value(ma, "rtp_host", kDefaultRtpHost);
+        pa_modargs_get_value_u32(ma, "rtp_port", &rtp_port);
+        pa_modargs_get_value_u32(ma, "http_port", &http_port);
+        pa_modargs_free(ma);
+    }
+
+    if (writer_kind == "opus") {
+        // rtp_host is a comma-separated list of host[:port] entries;
+        // rtp_port supplies the default port.
+        QList<OpusWriter::Destination> destinations;
+        foreach (const QString &entry,
+                 rtp_host.split(',', QString::SkipEmptyParts)) {
+            OpusWriter::Destination destination;
+            destination.host = entry.section(':', 0, 0);
+            destination.port = (quint16)rtp_port;
+            if (entry.contains(':')) {
+                destination.port = (quint16)entry.section(':', 1, 1).toUInt();
+            }
+            destinations.append(destination);
+        }
+        m_writer.reset(new OpusWriter(pa_sink, destinations));
+    } else if (writer_kind == "http") {
+        m_writer.reset(new HttpWriter(pa_sink, (quint16)http_port));
+    } else {
+        m_writer.reset(new WebRTCWriter(pa_sink, m_control_server.data()));
+    }
 
     // Initializes the sink.
     pa_sink->init(m_module, m_writer.data());
 
+    // Brings the control server up once the event loop is running. Signaling
+    // produced before then is queued inside the server.
+    QMetaObject::invokeMethod(m_control_server.data(), "start",
+                              Qt::QueuedConnection);
+
     // Starts the QCoreApplication.
     m_application = &app;
     m_application->exec();
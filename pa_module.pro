@@ -21,24 +21,43 @@ PRE_TARGETDEPS += \
 
 LIBS += \
     -L$${OUT_PWD}/webrtc -lwebrtc \
+    -lopus \
 
 INCLUDEPATH += \
     webrtc/ \
 
 HEADERS += \
     control_server.h \
+    encode_pool.h \
+    flight_recorder.h \
     pa_module.h\
     pa_sink.h \
     pa_sink_priv.h \
+    sample_ops.h \
+    sink_state.h \
+    spsc_ring_buffer.h \
+    stats.h \
+    thread_config.h \
+    trace.h \
     websocket_server.h \
     writer.h \
     writer_base.h \
+    writer_http.h \
+    writer_opus.h \
 
 SOURCES += \
+    encode_pool.cpp \
+    flight_recorder.cpp \
     pa_module.cpp \
     pa_sink.cpp \
+    sample_ops.cpp \
+    stats.cpp \
+    thread_config.cpp \
+    trace.cpp \
     websocket_server.cpp \
-    writer_base.cpp
+    writer_base.cpp \
+    writer_http.cpp \
+    writer_opus.cpp
 
 debug {
     DEFINES += WEBSOCKET_CERT_PATH=\\\"$$PWD/res\\\"
@@ -1,8 +1,13 @@
 TEMPLATE = subdirs
 
-SUBDIRS += pa_module webrtc
+SUBDIRS += pa_module webrtc bench microbench
 
 pa_module.file = pa_module.pro
 pa_module.depends = webrtc
 
 webrtc.subdir = webrtc
+
+bench.subdir = bench
+bench.depends = webrtc
+
+microbench.subdir = microbench
@@ -5,28 +5,49 @@ extern "C" {
 #include <pulse/introspect.h>
 #include <pulse/rtclock.h>
 #include <pulse/timeval.h>
+#include <pulse/volume.h>
 #include <pulsecore/modargs.h>
 #include <pulsecore/module.h>
 #include <pulsecore/namereg.h>
+#include <pulsecore/sample-util.h>
 } // extern "C"
 
+#include "sample_ops.h"
+#include "stats.h"
 #include "writer.h"
 
 namespace {
-const int kSampleRateHz = 44100;
-const int kBitRateBps   = 128000;
+// Defaults to 48 kHz: the WebRTC voice engine runs at 48 kHz internally, so
+// delivering at the same rate turns its PushResampler into a no-op.
+const int kDefaultSampleRateHz = 48000;
+const int kDefaultBitRateBps = 128000;
 const int kNumChannels  = 2;
 
 const char kDefaultSinkName[] = "PACC bridge";
-const pa_usec_t kBlocUsec = 2 * PA_USEC_PER_SEC;
+
+// The window the adaptive latency controller operates in. The floor keeps
+// interactive use (video sync, games) viable; the ceiling is the old fixed
+// two-second block budget which is only reached on badly congested links.
+const uint32_t kDefaultMinLatencyMsec = 50;
+const uint32_t kDefaultMaxLatencyMsec = 2000;
 
 const char* const kValidModargs[] = {
     "sink_name",
     "sink_properties",
     "master",
+    "format",
     "rate",
     "channels",
     "channel_map",
+    "latency_msec",
+    "max_latency_msec",
+    "rt_priority",
+    "rt_fifo",
+    "cpu_affinity",
+    "writer",
+    "rtp_host",
+    "rtp_port",
+    "http_port",
     NULL
 };
 } // namespace
@@ -60,26 +81,37 @@ void PASink::drop() {
 }
 
 
+const char *const *PASink::validModargs() {
+    return kValidModargs;
+}
+
 int PASink::init(pa_module *module, Writer *writer) {
     return d->init(module, writer);
 }
 
 int PASink::sampleRateHz() const {
-    return kSampleRateHz;
+    return d->m_sample_rate_hz;
 }
 int PASink::bitRateBps() const {
-    return kBitRateBps;
+    return d->m_state.read().bit_rate_bps;
+}
+void PASink::setBitRateBps(int bit_rate_bps) {
+    d->m_state.update([&](SinkState *state) {
+        state->bit_rate_bps = bit_rate_bps;
+    });
+    stats::counters().bit_rate_bps.store(bit_rate_bps,
+                                         std::memory_order_relaxed);
 }
 int PASink::numChannels() const {
     return kNumChannels;
 }
 
 bool PASink::isMuted() const {
-    return d->m_muted;
+    return d->m_state.read().muted;
 }
 
 quint32 PASink::volume() const {
-    return d->m_avg_volume;
+    return d->m_state.read().volume;
 }
 quint32 PASink::minVolume() const {
     return PA_VOLUME_MUTED;
@@ -97,14 +129,18 @@ PASinkPriv::PASinkPriv()
     : m_module(NULL)
     , m_writer(NULL)
 
+    , m_sample_rate_hz(kDefaultSampleRateHz)
+
     , m_sink(NULL)
     , m_thread(NULL)
     , m_rtpoll(NULL)
 
-    , m_event_subscription(NULL)
+    , m_latency_floor_usec(0)
+    , m_latency_ceil_usec(0)
+    , m_requested_latency_usec((pa_usec_t)-1)
+    , m_jitter_peak_usec(0)
 
-    , m_muted(false)
-    , m_avg_volume(0)
+    , m_event_subscription(NULL)
 {
 }
 
@@ -118,6 +154,47 @@ int PASinkPriv::init(pa_module *m, Writer *writer) {
         goto fail;
     }
 
+    // Reads the latency window for the adaptive controller.
+    uint32_t latency_msec;
+    latency_msec = kDefaultMinLatencyMsec;
+    uint32_t max_latency_msec;
+    max_latency_msec = kDefaultMaxLatencyMsec;
+    pa_modargs_get_value_u32(ma, "latency_msec", &latency_msec);
+    pa_modargs_get_value_u32(ma, "max_latency_msec", &max_latency_msec);
+    if (latency_msec <= 0 || max_latency_msec < latency_msec) {
+        pa_log("Invalid latency_msec/max_latency_msec arguments.");
+        goto fail;
+    }
+    m_latency_floor_usec = latency_msec * PA_USEC_PER_MSEC;
+    m_latency_ceil_usec = max_latency_msec * PA_USEC_PER_MSEC;
+
+    // Reads the sample rate.
+    uint32_t rate;
+    rate = kDefaultSampleRateHz;
+    pa_modargs_get_value_u32(ma, "rate", &rate);
+    if (!pa_sample_rate_valid(rate)) {
+        pa_log("Invalid rate argument.");
+        goto fail;
+    }
+    if (!m_writer->acceptsSampleRate((int)rate)) {
+        pa_log("The configured writer does not support rate %u.", rate);
+        goto fail;
+    }
+    m_sample_rate_hz = rate;
+
+    // Publishes the initial state for the cross-thread readers before the
+    // sink goes live.
+    m_state.update([&](SinkState *state) {
+        state->volume = PA_VOLUME_NORM;
+        state->muted = false;
+        state->sample_rate_hz = m_sample_rate_hz;
+        state->num_channels = kNumChannels;
+        state->latency_target_usec = m_latency_floor_usec;
+        state->bit_rate_bps = kDefaultBitRateBps;
+    });
+    stats::counters().bit_rate_bps.store(kDefaultBitRateBps,
+                                         std::memory_order_relaxed);
+
     pa_channel_map map;
     switch (kNumChannels) {
         case 1: pa_channel_map_init_mono(&map); break;
@@ -126,11 +203,35 @@ int PASinkPriv::init(pa_module *m, Writer *writer) {
         default: Q_ASSERT(false);
     }
 
+    // Negotiates the sample format: running the sink in the dominant
+    // client's format (format=float32le on float-heavy desktops) spares
+    // PulseAudio's generic per-sample conversion inside pa_sink_render;
+    // writers convert whole blocks with the vectorized kernels instead.
+    pa_sample_format_t format;
+    format = m_writer->sampleFormat();
+    const char *format_arg;
+    format_arg = pa_modargs_get_value(ma, "format", NULL);
+    if (format_arg) {
+        pa_sample_format_t requested = pa_parse_sample_format(format_arg);
+        if (requested == PA_SAMPLE_INVALID) {
+            pa_log("Invalid format argument.");
+            goto fail;
+        }
+        if (m_writer->acceptsSampleFormat(requested)) {
+            format = requested;
+        } else {
+            pa_log_warn("Writer does not accept format %s, using %s.",
+                        pa_sample_format_to_string(requested),
+                        pa_sample_format_to_string(format));
+        }
+    }
+    m_writer->setDeliveredSampleFormat(format);
+
     // Initializes the sample specs.
     pa_sample_spec ss;
     pa_sample_spec_init(&ss);
-    ss.format = m_writer->sampleFormat();
-    ss.rate = kSampleRateHz;
+    ss.format = format;
+    ss.rate = m_sample_rate_hz;
     ss.channels = map.channels;
     pa_assert(pa_sample_spec_valid(&ss));
 
@@ -172,7 +273,9 @@ int PASinkPriv::init(pa_module *m, Writer *writer) {
     pa_sink_set_asyncmsgq(m_sink, m_thread_mq.inq);
     pa_sink_set_rtpoll(m_sink, m_rtpoll);
 
-    m_block_usec = kBlocUsec;
+    // Starts with the smallest block budget; the adaptive controller grows
+    // it as delivery jitter is observed (see updateLatency()).
+    m_block_usec = m_latency_floor_usec;
     size_t nbytes;
     nbytes = pa_usec_to_bytes(m_block_usec, &m_sink->sample_spec);
     pa_sink_set_max_rewind(m_sink, nbytes);
@@ -242,10 +345,15 @@ void PASinkPriv::onSinkEvent(pa_subscription_event_type_t event_type,
         return;
     }
 
-    // Checks if we are muted and reads the volume.
-    m_muted = pa_sink_get_mute(m_sink, false);
+    // Checks if we are muted, reads the volume and publishes both.
+    bool muted = pa_sink_get_mute(m_sink, false);
     const pa_cvolume *volumes = pa_sink_get_volume(m_sink, false);
-    m_avg_volume = pa_cvolume_avg(volumes);
+    pa_volume_t avg_volume = pa_cvolume_avg(volumes);
+
+    m_state.update([&](SinkState *state) {
+        state->muted = muted;
+        state->volume = avg_volume;
+    });
 }
 
 int sinkProcessMsgCb(pa_msgobject *o, int code, void *data, int64_t offset,
@@ -271,15 +379,54 @@ void sinkUpdateRequestedLatencyCb(pa_sink *s) {
 void PASinkPriv::onSinkUpdateRequestedLatency(pa_sink *s) {
     pa_sink_assert_ref(s);
 
-    m_block_usec = pa_sink_get_requested_latency_within_thread(s);
+    // Only records what the clients ask for; the adaptive controller picks
+    // the actual block budget within this bound (see updateLatency()).
+    m_requested_latency_usec = pa_sink_get_requested_latency_within_thread(s);
+
+    if (m_requested_latency_usec == (pa_usec_t)-1) {
+        m_requested_latency_usec = s->thread_info.max_latency;
+    }
+}
+
+void PASinkPriv::updateLatency(pa_usec_t now) {
+    // The render lateness (how far the clock ran ahead of us before we got
+    // scheduled again) is our jitter signal: it reflects delays on the
+    // delivery side and in the scheduler.
+    pa_usec_t lateness = now > m_timestamp ? now - m_timestamp : 0;
 
-    if (m_block_usec == (pa_usec_t)-1) {
-        m_block_usec = s->thread_info.max_latency;
+    // Falling behind by more than a whole block budget means the receiver
+    // ran dry in the meantime.
+    if (lateness > m_block_usec) {
+        stats::counters().underruns.fetch_add(1, std::memory_order_relaxed);
     }
 
-    size_t nbytes = pa_usec_to_bytes(m_block_usec, &s->sample_spec);
-    pa_sink_set_max_rewind_within_thread(s, nbytes);
-    pa_sink_set_max_request_within_thread(s, nbytes);
+    // Tracks a decaying peak of the observed jitter.
+    m_jitter_peak_usec -= m_jitter_peak_usec / 8;
+    if (lateness > m_jitter_peak_usec) {
+        m_jitter_peak_usec = lateness;
+    }
+
+    // Budgets four times the peak jitter, clamped to the configured window
+    // and to what the clients requested.
+    pa_usec_t target = 4 * m_jitter_peak_usec;
+    target = PA_CLAMP(target, m_latency_floor_usec, m_latency_ceil_usec);
+    if (m_requested_latency_usec != (pa_usec_t)-1) {
+        target = PA_MIN(target, m_requested_latency_usec);
+    }
+
+    // Only reconfigures the sink when the budget moved significantly to
+    // avoid constant rewind/request churn.
+    if (target > m_block_usec + m_block_usec / 4 ||
+            target < m_block_usec - m_block_usec / 4) {
+        m_block_usec = target;
+        size_t nbytes = pa_usec_to_bytes(m_block_usec, &m_sink->sample_spec);
+        pa_sink_set_max_rewind_within_thread(m_sink, nbytes);
+        pa_sink_set_max_request_within_thread(m_sink, nbytes);
+
+        m_state.update([&](SinkState *state) {
+            state->latency_target_usec = m_block_usec;
+        });
+    }
 }
 
 void PASinkPriv::processRewind(pa_usec_t now) {
@@ -303,8 +450,23 @@ void PASinkPriv::processRewind(pa_usec_t now) {
         rewind_nbytes = in_buffer;
     }
 
-    pa_sink_process_rewind(m_sink, rewind_nbytes);
-    m_timestamp -= pa_bytes_to_usec(rewind_nbytes, &m_sink->sample_spec);
+    // The rendered bytes already sit in the writer's hand-off buffer.
+    // Reclaims them there first: only audio the writer could take back may
+    // be re-rendered, otherwise the new version would be delivered on top
+    // of the copy already on its way out. With the reclaim, an edit
+    // becomes audible after the network depth instead of the full buffer
+    // depth.
+    size_t reclaimed;
+    reclaimed = m_writer->rewind(rewind_nbytes);
+    reclaimed = pa_frame_align(reclaimed, &m_sink->sample_spec);
+    if (reclaimed <= 0) {
+        goto do_nothing;
+    }
+    stats::counters().rewound_bytes.fetch_add(reclaimed,
+                                              std::memory_order_relaxed);
+
+    pa_sink_process_rewind(m_sink, reclaimed);
+    m_timestamp -= pa_bytes_to_usec(reclaimed, &m_sink->sample_spec);
 
     return;
 
@@ -312,7 +474,49 @@ do_nothing:
     pa_sink_process_rewind(m_sink, 0);
 }
 
+void PASinkPriv::applyVolume(pa_memchunk *chunk) {
+    // Applies mute and software volume before the hand-off. Scaling the
+    // whole block with the vectorized kernel here is far cheaper than the
+    // per-sample volume plumbing inside the voice engine, and the receiver
+    // gets correctly attenuated PCM.
+    pa_sample_format_t format = m_sink->sample_spec.format;
+    if (format != PA_SAMPLE_S16LE && format != PA_SAMPLE_FLOAT32LE) {
+        return;
+    }
+
+    SinkState state = m_state.read();
+
+    if (state.muted) {
+        pa_memchunk_make_writable(chunk, 0);
+        pa_silence_memchunk(chunk, &m_sink->sample_spec);
+        return;
+    }
+
+    if (state.volume >= PA_VOLUME_NORM) {
+        return;
+    }
+
+    // Converts the cubic sink volume to a linear gain.
+    double linear = pa_sw_volume_to_linear(state.volume);
+
+    pa_memchunk_make_writable(chunk, 0);
+    void *p = pa_memblock_acquire(chunk->memblock);
+    uint8_t *samples = (uint8_t *)p + chunk->index;
+    if (format == PA_SAMPLE_S16LE) {
+        uint16_t factor_q15 = (uint16_t)PA_MIN(linear * 32768.0, 32767.0);
+        sample_ops::scaleS16((int16_t *)samples,
+                             chunk->length / sizeof(int16_t), factor_q15);
+    } else {
+        sample_ops::scaleFloat((float *)samples,
+                               chunk->length / sizeof(float),
+                               (float)linear);
+    }
+    pa_memblock_release(chunk->memblock);
+}
+
 void PASinkPriv::processRender(pa_usec_t now) {
+    updateLatency(now);
+
     /* This is the configured latency. Sink inputs connected to us
     might not have a single frame more than the maxrequest value
     queued. Hence: at maximum read this many bytes from the sink
@@ -329,11 +533,18 @@ void PASinkPriv::processRender(pa_usec_t now) {
         pa_memchunk chunk;
         pa_sink_render(m_sink, max_request, &chunk);
 
-        void *p = pa_memblock_acquire(chunk.memblock);
-        size_t bytes_written =
-                m_writer->write((const uint8_t *)p + chunk.index, chunk.length);
+        applyVolume(&chunk);
+
+        // Hands the chunk over by reference. Writers that can consume the
+        // memblock in place avoid a copy here; the others fall back to the
+        // contiguous write() (see BaseWriter).
+        size_t bytes_written = m_writer->write(&chunk);
         Q_ASSERT(bytes_written == chunk.length);
-        pa_memblock_release(chunk.memblock);
+
+        stats::counters().rendered_blocks.fetch_add(
+                    1, std::memory_order_relaxed);
+        stats::counters().rendered_bytes.fetch_add(
+                    chunk.length, std::memory_order_relaxed);
 
         pa_memblock_unref(chunk.memblock);
 
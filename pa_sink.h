@@ -13,12 +13,22 @@ public:
     static PASink &instance();
     void drop();
 
+    // The NULL-terminated list of module arguments the sink understands.
+    // Exposed so PAModule can pre-parse the thread scheduling arguments
+    // before the worker threads start.
+    static const char *const *validModargs();
+
     int init(pa_module *module, Writer *writer);
 
     int sampleRateHz() const;
-    int bitRateBps() const;
     int numChannels() const;
 
+    // The current encoder bitrate target. The adaptive controller moves it
+    // with the observed network conditions (see BitrateTuner); encoders
+    // re-read it and retune live.
+    int bitRateBps() const;
+    void setBitRateBps(int bit_rate_bps);
+
     bool isMuted() const;
 
     quint32 volume() const;
@@ -8,6 +8,8 @@ extern "C" {
 #include <pulsecore/thread.h>
 } // extern "C"
 
+#include "sink_state.h"
+
 class PASink;
 class Writer;
 
@@ -31,11 +33,15 @@ private:
     friend class PASink;
     void processRender(pa_usec_t now);
     void processRewind(pa_usec_t now);
+    void updateLatency(pa_usec_t now);
+    void applyVolume(pa_memchunk *chunk);
 
 
     pa_module *m_module;
     Writer *m_writer;
 
+    int m_sample_rate_hz;
+
     pa_sink *m_sink;
 
     pa_thread *m_thread;
@@ -45,10 +51,19 @@ private:
     pa_usec_t m_block_usec;
     pa_usec_t m_timestamp;
 
+    // Adaptive latency controller state (all owned by the sink thread
+    // except the configured window which is set once at init time).
+    pa_usec_t m_latency_floor_usec;
+    pa_usec_t m_latency_ceil_usec;
+    pa_usec_t m_requested_latency_usec;
+    pa_usec_t m_jitter_peak_usec;
+
     pa_subscription *m_event_subscription;
 
-    bool m_muted;
-    pa_volume_t m_avg_volume;
+    // Volume, mute, sample spec and latency target, published once per
+    // change so the ADM and writer threads can read a consistent snapshot
+    // without touching a lock.
+    SinkStateSeqlock m_state;
 };
 
 #endif // PA_SINK_PRIV_H
@@ -0,0 +1,141 @@
+#include "sample_ops.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace sample_ops {
+
+// (s * f) >> 15 per lane. The vector versions assemble the result from the
+// high and low halves of the 16x16 multiply: (hi << 1) | (lo >> 15).
+void scaleS16(int16_t *samples, size_t num_samples, uint16_t factor_q15) {
+    size_t i = 0;
+
+#if defined(__AVX2__)
+    const __m256i factor = _mm256_set1_epi16((short)factor_q15);
+    for (; i + 16 <= num_samples; i += 16) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(samples + i));
+        __m256i lo = _mm256_mullo_epi16(v, factor);
+        __m256i hi = _mm256_mulhi_epi16(v, factor);
+        __m256i scaled = _mm256_or_si256(_mm256_slli_epi16(hi, 1),
+                                         _mm256_srli_epi16(lo, 15));
+        _mm256_storeu_si256((__m256i *)(samples + i), scaled);
+    }
+#elif defined(__SSE2__)
+    const __m128i factor = _mm_set1_epi16((short)factor_q15);
+    for (; i + 8 <= num_samples; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(samples + i));
+        __m128i lo = _mm_mullo_epi16(v, factor);
+        __m128i hi = _mm_mulhi_epi16(v, factor);
+        __m128i scaled = _mm_or_si128(_mm_slli_epi16(hi, 1),
+                                      _mm_srli_epi16(lo, 15));
+        _mm_storeu_si128((__m128i *)(samples + i), scaled);
+    }
+#endif
+
+    for (; i < num_samples; ++i) {
+        samples[i] = (int16_t)(((int32_t)samples[i] * factor_q15) >> 15);
+    }
+}
+
+void scaleFloat(float *samples, size_t num_samples, float factor) {
+    size_t i = 0;
+
+#if defined(__AVX2__)
+    const __m256 vfactor = _mm256_set1_ps(factor);
+    for (; i + 8 <= num_samples; i += 8) {
+        __m256 v = _mm256_loadu_ps(samples + i);
+        _mm256_storeu_ps(samples + i, _mm256_mul_ps(v, vfactor));
+    }
+#elif defined(__SSE2__)
+    const __m128 vfactor = _mm_set1_ps(factor);
+    for (; i + 4 <= num_samples; i += 4) {
+        __m128 v = _mm_loadu_ps(samples + i);
+        _mm_storeu_ps(samples + i, _mm_mul_ps(v, vfactor));
+    }
+#endif
+
+    for (; i < num_samples; ++i) {
+        samples[i] *= factor;
+    }
+}
+
+bool isSilence(const void *buf, size_t length) {
+    const uint8_t *bytes = (const uint8_t *)buf;
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    __m128i acc = _mm_setzero_si128();
+    for (; i + 16 <= length; i += 16) {
+        acc = _mm_or_si128(acc,
+                           _mm_loadu_si128((const __m128i *)(bytes + i)));
+    }
+    // Any set bit in the accumulator means a non-zero byte was seen.
+    __m128i zero = _mm_setzero_si128();
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(acc, zero)) != 0xFFFF) {
+        return false;
+    }
+#endif
+
+    for (; i < length; ++i) {
+        if (bytes[i] != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Clamps to [-1, 1], scales to the S16 range and packs with saturation.
+void floatToS16(const float *in, int16_t *out, size_t num_samples) {
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    const __m128 scale = _mm_set1_ps(32767.0f);
+    const __m128 lo_clamp = _mm_set1_ps(-1.0f);
+    const __m128 hi_clamp = _mm_set1_ps(1.0f);
+    for (; i + 8 <= num_samples; i += 8) {
+        __m128 a = _mm_loadu_ps(in + i);
+        __m128 b = _mm_loadu_ps(in + i + 4);
+        a = _mm_min_ps(_mm_max_ps(a, lo_clamp), hi_clamp);
+        b = _mm_min_ps(_mm_max_ps(b, lo_clamp), hi_clamp);
+        __m128i ia = _mm_cvtps_epi32(_mm_mul_ps(a, scale));
+        __m128i ib = _mm_cvtps_epi32(_mm_mul_ps(b, scale));
+        _mm_storeu_si128((__m128i *)(out + i), _mm_packs_epi32(ia, ib));
+    }
+#endif
+
+    for (; i < num_samples; ++i) {
+        float sample = in[i];
+        if (sample > 1.0f) {
+            sample = 1.0f;
+        } else if (sample < -1.0f) {
+            sample = -1.0f;
+        }
+        out[i] = (int16_t)(sample * 32767.0f);
+    }
+}
+
+// Sign-extends to 32 bit by shifting the samples into the high halves, then
+// converts and scales by 1/32768.
+void s16ToFloat(const int16_t *in, float *out, size_t num_samples) {
+    size_t i = 0;
+
+#if defined(__SSE2__)
+    const __m128 scale = _mm_set1_ps(1.0f / 32768.0f);
+    for (; i + 8 <= num_samples; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(in + i));
+        __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+        __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+        _mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+        _mm_storeu_ps(out + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+    }
+#endif
+
+    for (; i < num_samples; ++i) {
+        out[i] = (float)in[i] / 32768.0f;
+    }
+}
+
+} // namespace sample_ops
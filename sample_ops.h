@@ -0,0 +1,31 @@
+#ifndef SAMPLE_OPS_H
+#define SAMPLE_OPS_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Vectorized whole-block sample kernels (SSE2/AVX2 with scalar fallback).
+// Everything operates in place on interleaved samples.
+namespace sample_ops {
+
+// Scales S16 samples by a Q1.15 gain factor in [0, 1). Callers skip the
+// call entirely for unity gain.
+void scaleS16(int16_t *samples, size_t num_samples, uint16_t factor_q15);
+
+// Scales float samples by a linear gain factor in [0, 1). Callers skip the
+// call entirely for unity gain.
+void scaleFloat(float *samples, size_t num_samples, float factor);
+
+// Returns whether the block is digital silence (all zero bytes).
+bool isSilence(const void *buf, size_t length);
+
+// Converts float samples in [-1, 1] to S16 with clamping. in and out must
+// not overlap.
+void floatToS16(const float *in, int16_t *out, size_t num_samples);
+
+// Converts S16 samples to float in [-1, 1). in and out must not overlap.
+void s16ToFloat(const int16_t *in, float *out, size_t num_samples);
+
+} // namespace sample_ops
+
+#endif // SAMPLE_OPS_H
@@ -0,0 +1,74 @@
+#ifndef SINK_STATE_H
+#define SINK_STATE_H
+
+#include <atomic>
+#include <cstdint>
+
+#include <QtCore/QtGlobal>
+
+// Snapshot of the externally visible sink state. Plain integers only, so a
+// copy is a handful of loads.
+struct SinkState {
+    uint32_t volume;               // pa_volume_t
+    bool muted;
+    uint32_t sample_rate_hz;
+    uint8_t num_channels;
+    uint64_t latency_target_usec;  // Current adaptive block budget.
+    uint32_t bit_rate_bps;         // Current adaptive encoder target.
+};
+
+// Publishes a SinkState across threads with a seqlock.
+//
+// Readers never write shared memory and retry only while an update is in
+// flight, so a read costs a few nanoseconds regardless of how many threads
+// poll the state. Updates are rare (sink events, latency adjustments) and
+// serialized by a writer spinlock, so multiple writer threads are fine.
+class SinkStateSeqlock {
+public:
+    SinkStateSeqlock()
+        : m_seq(0)
+        , m_value()
+    {
+        m_writer_lock.clear();
+    }
+
+    // Returns a consistent snapshot. Callable from any thread.
+    SinkState read() const {
+        for (;;) {
+            uint32_t seq = m_seq.load(std::memory_order_acquire);
+            if (seq & 1) {
+                continue; // An update is in flight.
+            }
+
+            SinkState value = m_value;
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (m_seq.load(std::memory_order_relaxed) == seq) {
+                return value;
+            }
+        }
+    }
+
+    // Applies the mutation under the writer lock and publishes the result.
+    template<typename Mutator>
+    void update(Mutator mutate) {
+        while (m_writer_lock.test_and_set(std::memory_order_acquire)) {
+        }
+
+        m_seq.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        mutate(&m_value);
+        m_seq.fetch_add(1, std::memory_order_release);
+
+        m_writer_lock.clear(std::memory_order_release);
+    }
+
+private:
+    Q_DISABLE_COPY(SinkStateSeqlock)
+
+    std::atomic<uint32_t> m_seq;
+    std::atomic_flag m_writer_lock;
+    SinkState m_value;
+};
+
+#endif // SINK_STATE_H
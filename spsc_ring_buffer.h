@@ -0,0 +1,130 @@
+#ifndef SPSC_RING_BUFFER_H
+#define SPSC_RING_BUFFER_H
+
+#include <atomic>
+#include <cstring>
+
+#include <QtCore/QScopedPointer>
+#include <QtCore/QtGlobal>
+
+// A lock-free single-producer/single-consumer byte ring buffer.
+//
+// Exactly one thread may write while one other thread reads. Neither side
+// ever blocks, locks or allocates which makes the buffer safe to use from
+// the real-time sink thread. The capacity is rounded up to the next power
+// of two so the positions can be masked instead of taking a modulo.
+class SpscRingBuffer {
+public:
+    explicit SpscRingBuffer(size_t capacity)
+        : m_read_pos(0)
+        , m_write_pos(0)
+    {
+        m_capacity = 1;
+        while (m_capacity < capacity) {
+            m_capacity <<= 1;
+        }
+        m_data.reset(new char[m_capacity]);
+    }
+
+    size_t capacity() const {
+        return m_capacity;
+    }
+
+    // Number of bytes that can currently be read. Only exact when called
+    // from the consumer thread.
+    size_t availableForRead() const {
+        return m_write_pos.load(std::memory_order_acquire) -
+               m_read_pos.load(std::memory_order_acquire);
+    }
+
+    // Number of bytes that can currently be written. Only exact when called
+    // from the producer thread.
+    size_t availableForWrite() const {
+        return m_capacity - availableForRead();
+    }
+
+    // Copies up to length bytes into the buffer and returns the number of
+    // bytes actually written. Must only be called from the producer thread.
+    size_t write(const void *buf, size_t length) {
+        size_t write_pos = m_write_pos.load(std::memory_order_relaxed);
+        size_t read_pos = m_read_pos.load(std::memory_order_acquire);
+
+        size_t free_bytes = m_capacity - (write_pos - read_pos);
+        if (length > free_bytes) {
+            length = free_bytes;
+        }
+
+        copyIn(write_pos, buf, length);
+        m_write_pos.store(write_pos + length, std::memory_order_release);
+        return length;
+    }
+
+    // Takes back up to length of the most recently written bytes the
+    // consumer has not read yet and returns the number of bytes reclaimed.
+    // Must only be called from the producer thread. A consumer that sampled
+    // the old write position inside a concurrent read() may still copy the
+    // reclaimed span out once; for the rewind use case that costs at most
+    // one stale block and is acceptable.
+    size_t unwrite(size_t length) {
+        size_t write_pos = m_write_pos.load(std::memory_order_relaxed);
+        size_t read_pos = m_read_pos.load(std::memory_order_acquire);
+
+        size_t filled_bytes = write_pos - read_pos;
+        if (length > filled_bytes) {
+            length = filled_bytes;
+        }
+
+        m_write_pos.store(write_pos - length, std::memory_order_release);
+        return length;
+    }
+
+    // Copies up to length bytes out of the buffer and returns the number of
+    // bytes actually read. Must only be called from the consumer thread.
+    size_t read(void *buf, size_t length) {
+        size_t read_pos = m_read_pos.load(std::memory_order_relaxed);
+        size_t write_pos = m_write_pos.load(std::memory_order_acquire);
+
+        size_t filled_bytes = write_pos - read_pos;
+        if (length > filled_bytes) {
+            length = filled_bytes;
+        }
+
+        copyOut(read_pos, buf, length);
+        m_read_pos.store(read_pos + length, std::memory_order_release);
+        return length;
+    }
+
+private:
+    Q_DISABLE_COPY(SpscRingBuffer)
+
+    void copyIn(size_t pos, const void *buf, size_t length) {
+        size_t offset = pos & (m_capacity - 1);
+        size_t tail = m_capacity - offset;
+        if (length <= tail) {
+            memcpy(m_data.data() + offset, buf, length);
+        } else {
+            memcpy(m_data.data() + offset, buf, tail);
+            memcpy(m_data.data(), (const char *)buf + tail, length - tail);
+        }
+    }
+
+    void copyOut(size_t pos, void *buf, size_t length) const {
+        size_t offset = pos & (m_capacity - 1);
+        size_t tail = m_capacity - offset;
+        if (length <= tail) {
+            memcpy(buf, m_data.data() + offset, length);
+        } else {
+            memcpy(buf, m_data.data() + offset, tail);
+            memcpy((char *)buf + tail, m_data.data(), length - tail);
+        }
+    }
+
+    QScopedArrayPointer<char> m_data;
+    size_t m_capacity;
+
+    // The positions grow monotonically and are masked on access.
+    std::atomic<size_t> m_read_pos;
+    std::atomic<size_t> m_write_pos;
+};
+
+#endif // SPSC_RING_BUFFER_H
@@ -0,0 +1,80 @@
+#include "stats.h"
+
+#include <QtCore/QJsonArray>
+
+namespace stats {
+
+LatencyHistogram::LatencyHistogram() {
+    for (size_t i = 0; i < kNumBuckets; ++i) {
+        m_buckets[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+void LatencyHistogram::record(uint64_t usec) {
+    // Bucket index is the position of the highest set bit, so bucket i
+    // covers [2^i, 2^(i+1)) microseconds.
+    size_t bucket = usec == 0 ? 0 : 63 - __builtin_clzll(usec);
+    if (bucket >= kNumBuckets) {
+        bucket = kNumBuckets - 1;
+    }
+    m_buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+QJsonObject LatencyHistogram::toJson() const {
+    QJsonArray buckets;
+    size_t last_used = 0;
+    for (size_t i = 0; i < kNumBuckets; ++i) {
+        if (m_buckets[i].load(std::memory_order_relaxed) > 0) {
+            last_used = i;
+        }
+    }
+    for (size_t i = 0; i <= last_used; ++i) {
+        buckets.append(
+                    (qint64)m_buckets[i].load(std::memory_order_relaxed));
+    }
+
+    QJsonObject json;
+    json["bucket_base_usec"] = 1;
+    json["buckets"] = buckets;
+    return json;
+}
+
+Counters &counters() {
+    static Counters counters;
+    return counters;
+}
+
+LatencyHistogram &renderToDeliverLatency() {
+    static LatencyHistogram histogram;
+    return histogram;
+}
+
+QJsonObject snapshot() {
+    const Counters &c = counters();
+
+    QJsonObject json;
+    json["rendered_blocks"] =
+            (qint64)c.rendered_blocks.load(std::memory_order_relaxed);
+    json["rendered_bytes"] =
+            (qint64)c.rendered_bytes.load(std::memory_order_relaxed);
+    json["dropped_bytes"] =
+            (qint64)c.dropped_bytes.load(std::memory_order_relaxed);
+    json["delivered_blocks"] =
+            (qint64)c.delivered_blocks.load(std::memory_order_relaxed);
+    json["deliver_failures"] =
+            (qint64)c.deliver_failures.load(std::memory_order_relaxed);
+    json["suppressed_blocks"] =
+            (qint64)c.suppressed_blocks.load(std::memory_order_relaxed);
+    json["rewound_bytes"] =
+            (qint64)c.rewound_bytes.load(std::memory_order_relaxed);
+    json["underruns"] =
+            (qint64)c.underruns.load(std::memory_order_relaxed);
+    json["buffer_fill_bytes"] =
+            (qint64)c.buffer_fill_bytes.load(std::memory_order_relaxed);
+    json["bit_rate_bps"] =
+            (qint64)c.bit_rate_bps.load(std::memory_order_relaxed);
+    json["render_to_deliver_latency"] = renderToDeliverLatency().toJson();
+    return json;
+}
+
+} // namespace stats
@@ -0,0 +1,58 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <atomic>
+#include <cstdint>
+
+#include <QtCore/QJsonObject>
+
+// Production observability for the audio pipeline.
+//
+// All counters and the histogram are plain atomics that the hot path
+// updates without locks; the control server publishes a JSON snapshot
+// periodically and on request (see ControlServerHandler).
+namespace stats {
+
+// Latency histogram with one power-of-two microsecond bucket per slot,
+// HDR style: cheap to update, coarse but monotone percentiles.
+class LatencyHistogram {
+public:
+    LatencyHistogram();
+
+    void record(uint64_t usec);
+
+    QJsonObject toJson() const;
+
+private:
+    static const size_t kNumBuckets = 32;
+
+    std::atomic<uint64_t> m_buckets[kNumBuckets];
+};
+
+// Counters for the render/deliver pipeline. buffer_fill_bytes and
+// bit_rate_bps are gauges, everything else grows monotonically.
+struct Counters {
+    std::atomic<uint64_t> rendered_blocks;
+    std::atomic<uint64_t> rendered_bytes;
+    std::atomic<uint64_t> dropped_bytes;
+    std::atomic<uint64_t> delivered_blocks;
+    std::atomic<uint64_t> deliver_failures;
+    std::atomic<uint64_t> suppressed_blocks;
+    std::atomic<uint64_t> rewound_bytes;
+    std::atomic<uint64_t> underruns;
+    std::atomic<uint64_t> buffer_fill_bytes;
+    std::atomic<uint64_t> bit_rate_bps;
+};
+
+Counters &counters();
+
+// Render-to-deliver latency, measured as the hand-off buffer depth at
+// delivery time.
+LatencyHistogram &renderToDeliverLatency();
+
+// Serializes all of the above for the control channel.
+QJsonObject snapshot();
+
+} // namespace stats
+
+#endif // STATS_H
@@ -0,0 +1,53 @@
+#include "thread_config.h"
+
+#include <cerrno>
+#include <cstring>
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <QtCore/QDebug>
+
+namespace thread_config {
+
+namespace {
+int g_policy = 0;
+int g_priority = 0;
+uint64_t g_cpu_mask = 0;
+} // namespace
+
+void configure(int policy, int priority, uint64_t cpu_mask) {
+    g_policy = policy;
+    g_priority = priority;
+    g_cpu_mask = cpu_mask;
+}
+
+void applyToCurrentThread(const char *thread_name) {
+    if (g_priority > 0) {
+        struct sched_param param;
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = g_priority;
+
+        if (pthread_setschedparam(pthread_self(), g_policy, &param) != 0) {
+            qWarning() << "Failed to set the scheduling policy for"
+                       << thread_name << ":" << strerror(errno);
+        }
+    }
+
+    if (g_cpu_mask != 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        for (int cpu = 0; cpu < 64; ++cpu) {
+            if (g_cpu_mask & ((uint64_t)1 << cpu)) {
+                CPU_SET(cpu, &cpus);
+            }
+        }
+
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0) {
+            qWarning() << "Failed to set the cpu affinity for"
+                       << thread_name << ":" << strerror(errno);
+        }
+    }
+}
+
+} // namespace thread_config
@@ -0,0 +1,26 @@
+#ifndef THREAD_CONFIG_H
+#define THREAD_CONFIG_H
+
+#include <cstdint>
+
+// Scheduling configuration for the audio worker threads.
+//
+// The sink thread gets PulseAudio's rtpoll treatment, but the delivery and
+// rtc threads are ordinary threads that a loaded box happily preempts. The
+// module arguments rt_priority, rt_fifo and cpu_affinity (parsed at module
+// load) let them run under SCHED_RR/SCHED_FIFO on a pinned set of CPUs.
+namespace thread_config {
+
+// Publishes the configuration. policy is SCHED_RR or SCHED_FIFO, priority
+// the real-time priority (0 disables scheduling changes), cpu_mask a bit
+// per CPU (0 disables pinning). Call once, before the threads start.
+void configure(int policy, int priority, uint64_t cpu_mask);
+
+// Applies the published configuration to the calling thread. Does nothing
+// when no configuration was published; failures (typically missing
+// privileges) are logged and otherwise ignored.
+void applyToCurrentThread(const char *thread_name);
+
+} // namespace thread_config
+
+#endif // THREAD_CONFIG_H
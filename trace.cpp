@@ -0,0 +1,88 @@
+#include "trace.h"
+
+#include <ctime>
+
+#include <QtCore/QJsonObject>
+#include <QtCore/QString>
+
+namespace trace {
+namespace {
+
+// Records per thread; must be a power of two.
+const size_t kRecordsPerThread = 4096;
+
+// Number of threads that can trace concurrently. Later threads drop their
+// records.
+const size_t kMaxRings = 16;
+
+struct ThreadRing {
+    std::atomic<uint64_t> write_pos;
+    Record records[kRecordsPerThread];
+};
+
+ThreadRing g_rings[kMaxRings];
+std::atomic<size_t> g_num_rings(0);
+
+__thread ThreadRing *t_ring = NULL;
+
+uint64_t nowUsec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+} // namespace
+
+namespace internal {
+
+void append(Category category, const char *name, int64_t arg) {
+    if (!t_ring) {
+        size_t index = g_num_rings.fetch_add(1, std::memory_order_relaxed);
+        if (index >= kMaxRings) {
+            return;
+        }
+        t_ring = &g_rings[index];
+    }
+
+    uint64_t pos = t_ring->write_pos.load(std::memory_order_relaxed);
+    Record &record = t_ring->records[pos & (kRecordsPerThread - 1)];
+    record.timestamp_usec = nowUsec();
+    record.category = (uint8_t)category;
+    record.name = name;
+    record.arg = arg;
+    t_ring->write_pos.store(pos + 1, std::memory_order_release);
+}
+
+} // namespace internal
+
+QJsonArray dump() {
+    QJsonArray out;
+
+    size_t num_rings = qMin(g_num_rings.load(std::memory_order_acquire),
+                            kMaxRings);
+    for (size_t i = 0; i < num_rings; ++i) {
+        const ThreadRing &ring = g_rings[i];
+        uint64_t end = ring.write_pos.load(std::memory_order_acquire);
+        uint64_t begin = end > kRecordsPerThread ? end - kRecordsPerThread : 0;
+
+        for (uint64_t pos = begin; pos < end; ++pos) {
+            const Record &record =
+                    ring.records[pos & (kRecordsPerThread - 1)];
+            if (!record.name) {
+                continue;
+            }
+
+            QJsonObject json_record;
+            json_record["thread"] = (int)i;
+            json_record["time_usec"] = (qint64)record.timestamp_usec;
+            json_record["category"] = (int)record.category;
+            json_record["name"] = QString::fromLatin1(record.name);
+            json_record["arg"] = (qint64)record.arg;
+            out.append(json_record);
+        }
+    }
+
+    return out;
+}
+
+} // namespace trace
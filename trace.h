@@ -0,0 +1,60 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <cstdint>
+
+#include <QtCore/QJsonArray>
+
+// Low-overhead tracing for the audio hot path.
+//
+// Trace points write fixed-size records into a lock-free per-thread ring;
+// no string formatting, no locks, no allocation. The category filter is a
+// compile-time constant, so trace points of disabled categories cost zero
+// instructions. The accumulated rings can be dumped through the control
+// server (see ControlServerHandler) to debug stalls after the fact.
+namespace trace {
+
+enum Category {
+    kAdm = 0,   // Audio-device-module entry points.
+    kSink,      // Sink render/rewind path.
+    kSignaling, // Control-plane / signaling events.
+
+    kNumCategories
+};
+
+// Only categories in this mask emit any code. The ADM entry points are
+// enabled by default: they are cheap now and were the reason this facility
+// exists.
+const uint32_t kEnabledCategories = (1u << kAdm) | (1u << kSignaling);
+
+struct Record {
+    uint64_t timestamp_usec;
+    uint8_t category;
+    const char *name; // Must point to a string literal.
+    int64_t arg;
+};
+
+namespace internal {
+void append(Category category, const char *name, int64_t arg);
+} // namespace internal
+
+// Records a trace event. The category is a template argument so the filter
+// is evaluated at compile time.
+template<Category C>
+inline void event(const char *name, int64_t arg = 0) {
+    if ((kEnabledCategories & (1u << C)) == 0) {
+        return;
+    }
+    internal::append(C, name, arg);
+}
+
+// Serializes the trace rings of all threads for the control server. The
+// rings are read without synchronization; records that are being written
+// concurrently may come out garbled, which is acceptable for a debugging
+// dump.
+QJsonArray dump();
+
+} // namespace trace
+
+#endif // TRACE_H
@@ -0,0 +1,66 @@
+#include "bitrate_tuner.h"
+
+#include <QtCore/QtGlobal>
+
+#include "pa_sink.h"
+
+namespace {
+// The window the controller operates in. Opus stays transparent for most
+// material well above the floor; the ceiling keeps a single stream from
+// swallowing a whole uplink.
+const int kMinBitRateBps = 32000;
+const int kMaxBitRateBps = 256000;
+
+// Additive increase, multiplicative decrease.
+const int kIncreaseStepBps = 8000;
+const int kDecreaseNum = 7;  // Decrease to 7/8 of the current target.
+const int kDecreaseDen = 8;
+
+// Loss fractions (per feedback round) that trigger a move. The gap between
+// the two keeps the controller from oscillating on borderline links.
+const double kLossDecreaseThreshold = 0.02;
+const double kLossIncreaseThreshold = 0.005;
+
+// An RTT this high means queues are building up even without loss yet.
+const int kRttCeilingMsec = 400;
+
+// Rounds to sit still after a decrease before probing upwards again.
+const int kHoldOffRounds = 3;
+} // namespace
+
+namespace webrtc {
+
+BitrateTuner::BitrateTuner()
+    : m_target_bps(PASink::instance().bitRateBps())
+    , m_hold_off(0)
+{
+}
+
+bool BitrateTuner::onRtcpFeedback(double fraction_lost, int rtt_msec,
+                                  int jitter_msec) {
+    Q_UNUSED(jitter_msec);
+
+    int target = m_target_bps;
+    if (fraction_lost > kLossDecreaseThreshold ||
+            rtt_msec > kRttCeilingMsec) {
+        target = target * kDecreaseNum / kDecreaseDen;
+        m_hold_off = kHoldOffRounds;
+    } else if (fraction_lost < kLossIncreaseThreshold) {
+        if (m_hold_off > 0) {
+            --m_hold_off;
+        } else {
+            target += kIncreaseStepBps;
+        }
+    }
+    target = qBound(kMinBitRateBps, target, kMaxBitRateBps);
+
+    if (target == m_target_bps) {
+        return false;
+    }
+
+    m_target_bps = target;
+    PASink::instance().setBitRateBps(target);
+    return true;
+}
+
+} // namespace webrtc
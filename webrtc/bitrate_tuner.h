@@ -0,0 +1,30 @@
+#ifndef WEBRTC_BITRATE_TUNER_H
+#define WEBRTC_BITRATE_TUNER_H
+
+namespace webrtc {
+
+// Moves the encoder bitrate target with the network conditions the peers
+// report via RTCP (see Conductor::rtcpFeedbackAppeared). Classic AIMD:
+// back off quickly while the link shows loss or a ballooning RTT, probe
+// upwards slowly while it is quiet. The target is published through
+// PASink::setBitRateBps; the Opus writer retunes from it live, and the
+// WebRTC path carries it to the voice-engine encoder via renegotiated
+// SDP (see ControlServerHandler::renegotiateBitrate).
+class BitrateTuner {
+public:
+    BitrateTuner();
+
+    // Feedback from one peer connection. With several peers the worst link
+    // governs: any report can lower the target, raising it requires quiet
+    // rounds from everyone. Returns whether the target moved, so the
+    // caller can push the new value out to the peers.
+    bool onRtcpFeedback(double fraction_lost, int rtt_msec, int jitter_msec);
+
+private:
+    int m_target_bps;
+    int m_hold_off;  // Feedback rounds to wait before raising again.
+};
+
+} // namespace webrtc
+
+#endif // WEBRTC_BITRATE_TUNER_H
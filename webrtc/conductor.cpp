@@ -10,13 +10,65 @@
 #include <webrtc/base/thread.h>
 #pragma GCC diagnostic pop
 
+#include <QtCore/QDateTime>
 #include <QtCore/QDebug>
+#include <QtCore/QRegExp>
+#include <QtCore/QStringList>
 #include <QtCore/QtGlobal>
 
+#include "pa_sink.h"
+
 namespace {
 const QString kStunServer = "stun:stun.l.google.com:19302";
 const QString kAudioLabel = "audio";
 const QString kStreamLabel = "stream";
+
+// How long a gathered local candidate stays in the cache. Host and
+// server-reflexive candidates rarely change faster than this.
+const qint64 kCandidateTtlMsec = 5 * 60 * 1000;
+
+// How often the send-side stats are polled for RTCP feedback. Receiver
+// reports arrive on a comparable cadence, so polling faster only reads the
+// same numbers twice.
+const int kFeedbackIntervalMsec = 1000;
+
+// Rewrites the Opus fmtp line of the given SDP to carry the bitrate
+// target: an existing maxaveragebitrate parameter is replaced, otherwise
+// one is appended (inserting a fresh fmtp line when the description has
+// none). Returns the SDP unchanged when it carries no Opus payload.
+QString applyBitrateTarget(const QString &sdp, int bit_rate_bps) {
+    QStringList lines = sdp.split("\r\n");
+
+    QRegExp rtpmap("^a=rtpmap:(\\d+) [oO]pus/.*");
+    int rtpmap_index = -1;
+    for (int i = 0; i < lines.size(); ++i) {
+        if (rtpmap.exactMatch(lines[i])) {
+            rtpmap_index = i;
+            break;
+        }
+    }
+    if (rtpmap_index < 0) {
+        return sdp;
+    }
+
+    QString param = QString("maxaveragebitrate=%1").arg(bit_rate_bps);
+    QString fmtp_prefix = QString("a=fmtp:%1 ").arg(rtpmap.cap(1));
+    for (int i = 0; i < lines.size(); ++i) {
+        if (!lines[i].startsWith(fmtp_prefix)) {
+            continue;
+        }
+        QRegExp existing("maxaveragebitrate=\\d+");
+        if (lines[i].contains(existing)) {
+            lines[i].replace(existing, param);
+        } else {
+            lines[i] += ";" + param;
+        }
+        return lines.join("\r\n");
+    }
+
+    lines.insert(rtpmap_index + 1, fmtp_prefix + param);
+    return lines.join("\r\n");
+}
 } // namespace
 
 namespace webrtc {
@@ -41,38 +93,133 @@ protected:
 };
 
 
-Conductor::Conductor(AudioDeviceModule *adm)
-    : m_signaling_thread(rtc::ThreadManager::Instance()->CurrentThread())
-    , m_wraps_signaling_thread(false)
-    , m_worker_thread(new rtc::Thread)
-{
-    freopen("/tmp/stdout.log", "w", stdout);
-    freopen("/tmp/stderr.log", "w", stderr);
-    m_worker_thread->Start();
+// Digests one GetStats round into RTCP feedback numbers. The cumulative
+// packet counters are turned into per-interval deltas so the loss fraction
+// reflects the last interval, not the whole session. OnComplete runs on the
+// signaling thread; the conductor only emits from there.
+class RtcpFeedbackObserver : public StatsObserver {
+public:
+    explicit RtcpFeedbackObserver(Conductor *conductor)
+        : m_conductor(conductor)
+        , m_last_packets_sent(0)
+        , m_last_packets_lost(0)
+    {
+    }
+
+    virtual void OnComplete(const StatsReports &reports) {
+        int64_t packets_sent = -1;
+        int64_t packets_lost = 0;
+        int rtt_msec = 0;
+        int jitter_msec = 0;
+
+        for (size_t i = 0; i < reports.size(); ++i) {
+            const StatsReport *report = reports[i];
+            if (report->type() != StatsReport::kStatsReportTypeSsrc) {
+                continue;
+            }
+            // Only the send-side ssrc report carries receiver-report data.
+            if (!report->FindValue(StatsReport::kStatsValueNameBytesSent)) {
+                continue;
+            }
+
+            const StatsReport::Value *value;
+            if ((value = report->FindValue(
+                         StatsReport::kStatsValueNamePacketsSent))) {
+                packets_sent = valueToInt(value);
+            }
+            if ((value = report->FindValue(
+                         StatsReport::kStatsValueNamePacketsLost))) {
+                packets_lost = valueToInt(value);
+            }
+            if ((value = report->FindValue(
+                         StatsReport::kStatsValueNameRtt))) {
+                rtt_msec = (int)valueToInt(value);
+            }
+            if ((value = report->FindValue(
+                         StatsReport::kStatsValueNameJitterReceived))) {
+                jitter_msec = (int)valueToInt(value);
+            }
+        }
+
+        if (packets_sent < 0) {
+            return; // No send report yet.
+        }
+
+        int64_t delta_sent = packets_sent - m_last_packets_sent;
+        int64_t delta_lost = packets_lost - m_last_packets_lost;
+        m_last_packets_sent = packets_sent;
+        m_last_packets_lost = packets_lost;
+
+        // The counters restart from zero on an ICE restart; skip the
+        // crossover interval.
+        if (delta_sent <= 0) {
+            return;
+        }
+        if (delta_lost < 0) {
+            delta_lost = 0;
+        }
+
+        double fraction_lost =
+                (double)delta_lost / (double)(delta_sent + delta_lost);
+        m_conductor->onRtcpFeedback(fraction_lost, rtt_msec, jitter_msec);
+    }
+
+protected:
+    ~RtcpFeedbackObserver() {}
+
+private:
+    static int64_t valueToInt(const StatsReport::Value *value) {
+        switch (value->type()) {
+            case StatsReport::Value::kInt:   return value->int_val();
+            case StatsReport::Value::kInt64: return value->int64_val();
 
-    if (!m_signaling_thread) {
-        m_signaling_thread =
-                rtc::ThreadManager::Instance()->WrapCurrentThread();
-        m_wraps_signaling_thread = true;
+            default: return 0;
+        }
     }
-    m_peer_connection_factory = CreatePeerConnectionFactory(
-                m_worker_thread.data(), m_signaling_thread, adm, NULL, NULL);
+
+    Conductor *m_conductor;
+    int64_t m_last_packets_sent;
+    int64_t m_last_packets_lost;
+};
+
+
+Conductor::Conductor(PeerConnectionFactoryInterface *factory)
+    : m_peer_connection_factory(factory)
+{
     Q_ASSERT(m_peer_connection_factory.get() &&
-             "Failed to initialize PeerConnectionFactory");
+             "No PeerConnectionFactory given");
+
+    m_feedback_observer =
+            new rtc::RefCountedObject<RtcpFeedbackObserver>(this);
+    connect(&m_feedback_timer, &QTimer::timeout, [this]() {
+        pollStats();
+    });
 }
 
 Conductor::~Conductor() {
     close();
-
-    if (m_wraps_signaling_thread) {
-        rtc::ThreadManager::Instance()->UnwrapCurrentThread();
-    }
 }
 
 void Conductor::close() {
+    m_feedback_timer.stop();
     deletePeerConnection();
 }
 
+void Conductor::pollStats() {
+    if (!m_peer_connection.get()) {
+        return;
+    }
+
+    m_peer_connection->GetStats(
+                m_feedback_observer.get(), NULL,
+                PeerConnectionInterface::kStatsOutputLevelStandard);
+}
+
+void Conductor::onRtcpFeedback(double fraction_lost, int rtt_msec,
+                               int jitter_msec) {
+    Q_EMIT rtcpFeedbackAppeared(fraction_lost, rtt_msec, jitter_msec);
+}
+
 bool Conductor::open() {
     if (m_peer_connection.get()) {
         return true;
@@ -90,9 +237,49 @@ bool Conductor::open() {
                 MediaConstraintsInterface::kOfferToReceiveVideo, false);
     m_peer_connection->CreateOffer(this, &constraints);
 
+    m_feedback_timer.start(kFeedbackIntervalMsec);
+
     return m_peer_connection.get() != NULL;
 }
 
+bool Conductor::restart() {
+    if (!m_peer_connection.get()) {
+        return open();
+    }
+
+    // Requests an ICE restart on the live connection: a fresh offer with new
+    // ufrag/pwd while the transport, the streams and the factory stay
+    // untouched. Gathering usually rediscovers the same ports within
+    // milliseconds.
+    FakeConstraints constraints;
+    constraints.AddMandatory(
+                MediaConstraintsInterface::kOfferToReceiveAudio, false);
+    constraints.AddOptional(
+                MediaConstraintsInterface::kOfferToReceiveVideo, false);
+    constraints.AddMandatory(MediaConstraintsInterface::kIceRestart, true);
+    m_peer_connection->CreateOffer(this, &constraints);
+
+    return true;
+}
+
+bool Conductor::renegotiate() {
+    if (!m_peer_connection.get()) {
+        return false;
+    }
+
+    // A fresh offer without an ICE restart: the transport and gathered
+    // candidates stay untouched, only the refreshed fmtp parameters travel
+    // to the receiver.
+    FakeConstraints constraints;
+    constraints.AddMandatory(
+                MediaConstraintsInterface::kOfferToReceiveAudio, false);
+    constraints.AddOptional(
+                MediaConstraintsInterface::kOfferToReceiveVideo, false);
+    m_peer_connection->CreateOffer(this, &constraints);
+
+    return true;
+}
+
 bool Conductor::createPeerConnection() {
     Q_ASSERT(!m_peer_connection.get());
 
@@ -180,7 +367,37 @@ QList<const IceCandidateInterface *> Conductor::iceCandidates() const {
     return ret;
 }
 
+QList<Conductor::CachedCandidate> Conductor::cachedCandidates() const {
+    QList<CachedCandidate> ret;
+
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    foreach (const CachedCandidate &candidate, m_cached_candidates) {
+        if (candidate.expires_at_msec > now) {
+            ret.append(candidate);
+        }
+    }
+
+    return ret;
+}
+
 void Conductor::setRemoteDescription(SessionDescriptionInterface *desc) {
+    // The voice engine configures the send codec from the remote
+    // description, and maxaveragebitrate is declared by the receiver
+    // (RFC 7587), so the tuner's target goes into the client's answer.
+    // This API generation has no live knob on the send codec; rewriting
+    // the answer is the only path the target reaches the encoder on.
+    std::string sdp;
+    if (desc->ToString(&sdp)) {
+        QString munged = applyBitrateTarget(QString::fromStdString(sdp),
+                                            PASink::instance().bitRateBps());
+        SessionDescriptionInterface *replacement = CreateSessionDescription(
+                    desc->type(), munged.toStdString(), NULL);
+        if (replacement) {
+            delete desc;
+            desc = replacement;
+        }
+    }
+
     m_peer_connection->SetRemoteDescription(
                 DummySetSessionDescriptionObserver::create(), desc);
 }
@@ -212,6 +429,25 @@ void Conductor::OnIceConnectionChange(
     Q_UNUSED(new_state);
 }
 void Conductor::OnIceCandidate(const IceCandidateInterface *candidate) {
+    // Caches the candidate in serialized form so it survives a close() or
+    // an ICE restart. Expired entries are pruned on the way.
+    std::string sdp;
+    if (candidate->ToString(&sdp)) {
+        qint64 now = QDateTime::currentMSecsSinceEpoch();
+        for (int i = m_cached_candidates.size() - 1; i >= 0; --i) {
+            if (m_cached_candidates[i].expires_at_msec <= now) {
+                m_cached_candidates.removeAt(i);
+            }
+        }
+
+        CachedCandidate cached;
+        cached.sdp_mid = QString::fromStdString(candidate->sdp_mid());
+        cached.sdp_mline_index = candidate->sdp_mline_index();
+        cached.sdp = QString::fromStdString(sdp);
+        cached.expires_at_msec = now + kCandidateTtlMsec;
+        m_cached_candidates.append(cached);
+    }
+
     Q_EMIT iceCandidateAppeared(candidate);
 }
 
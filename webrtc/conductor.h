@@ -9,15 +9,14 @@
 
 #include <QtCore/QList>
 #include <QtCore/QObject>
-#include <QtCore/QScopedPointer>
 #include <QtCore/QString>
-
-namespace rtc {
-class Thread;
-} // namespace rtc
+#include <QtCore/QTimer>
 
 namespace webrtc {
 
+// Manages the lifetime and signaling of a single peer connection. Several
+// conductors may share the same peer-connection factory: the voice engine
+// then fans the one captured audio stream out to every peer.
 class Conductor
         : public QObject
         , public PeerConnectionObserver
@@ -25,11 +24,39 @@ class Conductor
     Q_OBJECT
 
 public:
-    explicit Conductor(AudioDeviceModule *adm);
+    // A gathered local candidate, serialized so it outlives the session
+    // description it came from. Entries expire after their TTL.
+    struct CachedCandidate {
+        QString sdp_mid;
+        int sdp_mline_index;
+        QString sdp;
+        qint64 expires_at_msec;
+    };
+
+    explicit Conductor(PeerConnectionFactoryInterface *factory);
 
     bool open();
 
+    // Re-negotiates on the existing peer connection via an ICE restart
+    // instead of tearing it down. The factory, the worker thread and the
+    // transport stay alive, which makes a reconnect a sub-second affair.
+    // Falls back to open() when there is no connection yet.
+    bool restart();
+
+    // Creates a fresh offer on the live connection without an ICE restart.
+    // The answer it draws from the client is rewritten to carry the
+    // current encoder bitrate target (see setRemoteDescription). Used
+    // after the bitrate tuner moved the target; returns false when there
+    // is no connection to renegotiate.
+    bool renegotiate();
+
     QList<const IceCandidateInterface *> iceCandidates() const;
+
+    // Previously gathered candidates that have not expired yet. Useful right
+    // after a restart, when the receiver can already start connectivity
+    // checks against the known ports while gathering re-runs.
+    QList<CachedCandidate> cachedCandidates() const;
+
     const SessionDescriptionInterface *localDescription() const;
 
     void setRemoteDescription(SessionDescriptionInterface *desc);
@@ -37,9 +64,17 @@ public:
 
     virtual void close();
 
+    // Entry point for the stats observer: forwards one interval's worth of
+    // RTCP receiver-report feedback. Called on the signaling thread; only
+    // emits rtcpFeedbackAppeared, whose receivers run queued on their own
+    // thread.
+    void onRtcpFeedback(double fraction_lost, int rtt_msec, int jitter_msec);
+
 Q_SIGNALS:
     void iceCandidateAppeared(const IceCandidateInterface *candidate);
     void localDescriptionAppeared(const SessionDescriptionInterface *desc);
+    void rtcpFeedbackAppeared(double fraction_lost, int rtt_msec,
+                              int jitter_msec);
 
 protected:
     ~Conductor();
@@ -69,15 +104,20 @@ protected:
 private:
     void sendIceCandidates();
 
-    rtc::Thread *m_signaling_thread;
-    bool m_wraps_signaling_thread;
-    QScopedPointer<rtc::Thread> m_worker_thread;
+    // Periodically asks the peer connection for its send-side stats; the
+    // observer digests them into rtcpFeedbackAppeared.
+    void pollStats();
 
     rtc::scoped_refptr<PeerConnectionInterface> m_peer_connection;
     rtc::scoped_refptr<PeerConnectionFactoryInterface>
         m_peer_connection_factory;
 
     rtc::scoped_refptr<MediaStreamInterface> m_stream;
+
+    QList<CachedCandidate> m_cached_candidates;
+
+    rtc::scoped_refptr<StatsObserver> m_feedback_observer;
+    QTimer m_feedback_timer;
 };
 
 } // namespace webrtc
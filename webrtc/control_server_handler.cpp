@@ -5,8 +5,15 @@
 #include <QtCore/QJsonObject>
 #include <QtCore/QJsonValue>
 
+#include <QtCore/QTimer>
+
+#include "bitrate_tuner.h"
 #include "conductor.h"
 #include "control_server.h"
+#include "pa_audio_device_module.h"
+#include "pa_sink.h"
+#include "stats.h"
+#include "trace.h"
 
 namespace {
 const int kControlServerPort = 51348;
@@ -15,12 +22,39 @@ const QString kMsgTypeReset = "reset";
 const QString kMsgTypeGetIceCandidates = "getIceCandidates";
 const QString kMsgTypeGetSessionDescription = "getSessionDescription";
 
-// Names used for a IceCandidate JSON object.
+// Dumps the in-memory trace rings (see trace.h).
+const QString kMsgTypeGetTrace = "getTrace";
+const QString kMsgTypeTrace = "trace";
+
+// Pipeline statistics (see stats.h), published periodically and on request.
+const QString kMsgTypeGetStats = "getStats";
+const QString kMsgTypeStats = "stats";
+const int kStatsIntervalMsec = 5000;
+
+// Announces a flight-record snapshot taken after an underrun; the payload
+// is the path of the snapshot file.
+const QString kMsgTypeFlightRecord = "flightRecord";
+
+// Names used for a IceCandidate JSON object. Outgoing candidates are
+// batched into an array payload; incoming ones still arrive one at a time.
 const QString kMsgTypeIceCandidate = "iceCandidate";
+const QString kMsgTypeIceCandidates = "iceCandidates";
 const QString kCandidateSdpMidName = "sdpMid";
 const QString kCandidateSdpMlineIndexName = "sdpMLineIndex";
 const QString kCandidateSdpName = "candidate";
 
+// How long appearing candidates are collected before the batch is sent.
+const int kCandidateBatchWindowMsec = 20;
+
+QJsonObject makeJsonCandidate(const QString &sdp_mid, int sdp_mline_index,
+                              const QString &sdp) {
+    QJsonObject json_candidate;
+    json_candidate[kCandidateSdpMidName] = sdp_mid;
+    json_candidate[kCandidateSdpMlineIndexName] = sdp_mline_index;
+    json_candidate[kCandidateSdpName] = sdp;
+    return json_candidate;
+}
+
 // Names used for a SessionDescription JSON object.
 const QString kMsgTypeSessionDescription = "sessionDescription";
 const QString kSessionDescriptionTypeName = "type";
@@ -31,64 +65,186 @@ const QString kSessionDescriptionSdpName = "sdp";
 namespace webrtc {
 
 ControlServerHandler::ControlServerHandler(ControlServer *control_server,
-                                           Conductor *conductor)
+                                           PeerConnectionFactoryInterface *factory,
+                                           PAAudioDeviceModule *adm)
     : m_control_server(control_server)
-    , m_conductor(conductor)
+    , m_factory(factory)
+    , m_adm(adm)
+    , m_seen_underruns(stats::counters().underruns.load(
+                           std::memory_order_relaxed))
+    , m_bitrate_tuner(new BitrateTuner)
+    , m_negotiated_bit_rate_bps(PASink::instance().bitRateBps())
 {
     connect(control_server, &ControlServer::clientConnected,
             this, &ControlServerHandler::onClientConnected);
+    connect(control_server, &ControlServer::clientDisconnected,
+            this, &ControlServerHandler::onClientDisconnected);
     connect(control_server, &ControlServer::messageReceived,
             this, &ControlServerHandler::onMessage);
+
+    // Publishes the pipeline statistics periodically while clients are
+    // connected.
+    QTimer *stats_timer = new QTimer(this);
+    connect(stats_timer, &QTimer::timeout, [=]() {
+        checkUnderruns();
+        if (!m_conductors.isEmpty()) {
+            m_control_server->sendMessage(kMsgTypeStats, stats::snapshot());
+        }
+    });
+    stats_timer->start(kStatsIntervalMsec);
 }
 
 ControlServerHandler::~ControlServerHandler() {
 }
 
-void ControlServerHandler::onMessage(const QString &type,
+Conductor *ControlServerHandler::conductor(quintptr client_id) const {
+    return m_conductors.value(client_id).get();
+}
+
+void ControlServerHandler::onMessage(quintptr client_id, const QString &type,
                                      const QJsonValue &payload) {
+    if (!conductor(client_id)) {
+        qWarning() << "Message from client without conductor. Ignoring.";
+        return;
+    }
+
     if (kMsgTypeReset == type) {
-        handleReset();
+        handleReset(client_id);
+    } else if (kMsgTypeGetTrace == type) {
+        m_control_server->sendMessage(client_id, kMsgTypeTrace, trace::dump());
+    } else if (kMsgTypeGetStats == type) {
+        m_control_server->sendMessage(client_id, kMsgTypeStats,
+                                      stats::snapshot());
     } else if (kMsgTypeGetIceCandidates == type) {
-        handleGetIceCandidates();
+        handleGetIceCandidates(client_id);
     } else if (kMsgTypeGetSessionDescription == type) {
-        handleGetSessionDescription();
+        handleGetSessionDescription(client_id);
     } else if (kMsgTypeIceCandidate == type) {
-        handleIceCandidate(payload);
+        handleIceCandidate(client_id, payload);
     } else if (kMsgTypeSessionDescription == type) {
-        handleSessionDescription(payload);
+        handleSessionDescription(client_id, payload);
     }
 }
 
-void ControlServerHandler::onClientConnected() {
-    Q_ASSERT(m_conductor->open() &&
+void ControlServerHandler::onClientConnected(quintptr client_id) {
+    // Creates the conductor for this client. All conductors share the
+    // factory, so the audio fan-out to the peers happens inside the voice
+    // engine.
+    rtc::scoped_refptr<Conductor> conductor(
+                new rtc::RefCountedObject<Conductor>(m_factory.get()));
+    m_conductors.insert(client_id, conductor);
+
+    // Feeds this peer's RTCP feedback into the shared bitrate tuner. The
+    // context argument queues the call onto this thread; the signal is
+    // emitted from the signaling thread. A moved target is pushed back out
+    // to the peers, since the encoder only learns of it via the SDP.
+    connect(conductor.get(), &Conductor::rtcpFeedbackAppeared, this,
+            [=](double fraction_lost, int rtt_msec, int jitter_msec) {
+        if (m_bitrate_tuner->onRtcpFeedback(fraction_lost, rtt_msec,
+                                            jitter_msec)) {
+            renegotiateBitrate();
+        }
+    });
+
+    Q_ASSERT(conductor->open() &&
              "Failed to initialize the conductor.");
 }
 
-void ControlServerHandler::handleReset() {
-    m_conductor->close();
-    Q_ASSERT(m_conductor->open() &&
-             "Failed to initialize the conductor.");
+void ControlServerHandler::onClientDisconnected(quintptr client_id) {
+    // Closes and releases this client's peer connection; the remaining
+    // clients are unaffected.
+    rtc::scoped_refptr<Conductor> conductor = m_conductors.take(client_id);
+    if (conductor.get()) {
+        conductor->close();
+    }
+
+    // Drops any candidate batch that never got flushed.
+    m_pending_candidates.remove(client_id);
+    m_flush_scheduled.remove(client_id);
+}
+
+void ControlServerHandler::checkUnderruns() {
+    uint64_t underruns =
+            stats::counters().underruns.load(std::memory_order_relaxed);
+    if (underruns == m_seen_underruns) {
+        return;
+    }
+    m_seen_underruns = underruns;
+
+    // Preserves the evidence: the flight-recorder ring keeps overwriting
+    // itself, so the audio around the underrun would be gone within its
+    // capacity. One snapshot covers every trip since the last round.
+    QString dest;
+    if (m_adm->snapshotFlightRecord(&dest)) {
+        qWarning() << "Underrun detected; flight record snapshotted to"
+                   << dest;
+        m_control_server->sendMessage(kMsgTypeFlightRecord, dest);
+    }
 }
 
+void ControlServerHandler::renegotiateBitrate() {
+    // The tuner's target only reaches the encoder through the remote
+    // description (see Conductor::setRemoteDescription), so a moved target
+    // needs a round of fresh offers to draw new answers. The 10 %
+    // hysteresis keeps the tuner's additive probe steps from triggering a
+    // renegotiation every quiet round.
+    int target = PASink::instance().bitRateBps();
+    if (qAbs(target - m_negotiated_bit_rate_bps) <
+            m_negotiated_bit_rate_bps / 10) {
+        return;
+    }
+    m_negotiated_bit_rate_bps = target;
+
+    foreach (const rtc::scoped_refptr<Conductor> &c, m_conductors) {
+        c->renegotiate();
+    }
+}
+
+void ControlServerHandler::handleReset(quintptr client_id) {
+    // Warm restart: the peer connection, factory and worker thread survive
+    // and only ICE is re-negotiated, so the receiver reconnects in well
+    // under a second instead of re-gathering everything from scratch.
+    Conductor *c = conductor(client_id);
+    Q_ASSERT(c->restart() &&
+             "Failed to restart the conductor.");
+}
 
-void ControlServerHandler::sendIceCandidate(
-        const IceCandidateInterface *ice_candidate) {
-    // Constructs the json candidate.
+
+void ControlServerHandler::queueIceCandidate(
+        quintptr client_id, const IceCandidateInterface *ice_candidate) {
     std::string sdp;
     Q_ASSERT(ice_candidate->ToString(&sdp) &&
              "Failed to serialize candidate");
 
-    QJsonObject json_candidate;
-    json_candidate[kCandidateSdpMidName] =
-            QString::fromStdString(ice_candidate->sdp_mid());
-    json_candidate[kCandidateSdpMlineIndexName] =
-            ice_candidate->sdp_mline_index();
-    json_candidate[kCandidateSdpName] = QString::fromStdString(sdp);
+    m_pending_candidates[client_id].append(makeJsonCandidate(
+                QString::fromStdString(ice_candidate->sdp_mid()),
+                ice_candidate->sdp_mline_index(),
+                QString::fromStdString(sdp)));
+
+    // Arms the flush timer once per batch; candidates appearing within the
+    // window ride along in the same message.
+    if (!m_flush_scheduled.contains(client_id)) {
+        m_flush_scheduled.insert(client_id);
+        QTimer::singleShot(kCandidateBatchWindowMsec, this, [=]() {
+            flushIceCandidates(client_id);
+        });
+    }
+}
+
+void ControlServerHandler::flushIceCandidates(quintptr client_id) {
+    m_flush_scheduled.remove(client_id);
 
-    m_control_server->sendMessage(kMsgTypeIceCandidate, json_candidate);
+    QJsonArray candidates = m_pending_candidates.take(client_id);
+    if (candidates.isEmpty()) {
+        return;
+    }
+
+    m_control_server->sendMessage(client_id, kMsgTypeIceCandidates,
+                                  candidates);
 }
 
 void ControlServerHandler::sendSessionDescription(
+        quintptr client_id,
         const SessionDescriptionInterface *session_description) {
     std::string sdp;
     Q_ASSERT(session_description->ToString(&sdp) &&
@@ -100,43 +256,70 @@ void ControlServerHandler::sendSessionDescription(
     json_session_description[kSessionDescriptionSdpName] =
             QString::fromStdString(sdp);
 
-    m_control_server->sendMessage(kMsgTypeSessionDescription,
+    m_control_server->sendMessage(client_id, kMsgTypeSessionDescription,
                                   json_session_description);
 }
 
 
-void ControlServerHandler::handleGetIceCandidates() {
-    // Sends the already known ice candidates. New ones are forwarded as they
-    // appear.
-    foreach (const IceCandidateInterface *candidate,
-             m_conductor->iceCandidates()) {
-        sendIceCandidate(candidate);
+void ControlServerHandler::handleGetIceCandidates(quintptr client_id) {
+    Conductor *c = conductor(client_id);
+
+    // Sends the already known ice candidates as one batch. New ones are
+    // collected and forwarded as they appear. If gathering has not produced
+    // anything yet (right after an ICE restart) the cached candidates from
+    // the previous round are sent so the receiver can start connectivity
+    // checks against the known ports.
+    QJsonArray json_candidates;
+    QList<const IceCandidateInterface *> candidates = c->iceCandidates();
+    if (!candidates.isEmpty()) {
+        foreach (const IceCandidateInterface *candidate, candidates) {
+            std::string sdp;
+            Q_ASSERT(candidate->ToString(&sdp) &&
+                     "Failed to serialize candidate");
+            json_candidates.append(makeJsonCandidate(
+                        QString::fromStdString(candidate->sdp_mid()),
+                        candidate->sdp_mline_index(),
+                        QString::fromStdString(sdp)));
+        }
+    } else {
+        foreach (const Conductor::CachedCandidate &cached,
+                 c->cachedCandidates()) {
+            json_candidates.append(makeJsonCandidate(
+                        cached.sdp_mid, cached.sdp_mline_index, cached.sdp));
+        }
+    }
+    if (!json_candidates.isEmpty()) {
+        m_control_server->sendMessage(client_id, kMsgTypeIceCandidates,
+                                      json_candidates);
     }
 
     // Subscribes for further appearing candidates.
-    connect(m_conductor, &Conductor::iceCandidateAppeared,
+    connect(c, &Conductor::iceCandidateAppeared,
             [=](const IceCandidateInterface *candidate) {
-        sendIceCandidate(candidate);
+        queueIceCandidate(client_id, candidate);
     });
 }
 
-void ControlServerHandler::handleGetSessionDescription() {
+void ControlServerHandler::handleGetSessionDescription(quintptr client_id) {
+    Conductor *c = conductor(client_id);
+
     // If there already is a session description around we immediately send it.
     // Otherwise it will be forwarded as it appears.
     const SessionDescriptionInterface *local_description =
-            m_conductor->localDescription();
+            c->localDescription();
     if (local_description) {
-        sendSessionDescription(local_description);
+        sendSessionDescription(client_id, local_description);
     }
 
     // Subscribes for further appearing descriptions.
-    connect(m_conductor, &Conductor::localDescriptionAppeared,
+    connect(c, &Conductor::localDescriptionAppeared,
             [=](const SessionDescriptionInterface *session_description) {
-        sendSessionDescription(session_description);
+        sendSessionDescription(client_id, session_description);
     });
 }
 
-void ControlServerHandler::handleIceCandidate(const QJsonValue &payload) {
+void ControlServerHandler::handleIceCandidate(quintptr client_id,
+                                              const QJsonValue &payload) {
     if (!payload.isObject()) {
         qWarning() << "Invalid ice candidate payload";
         return;
@@ -158,10 +341,11 @@ void ControlServerHandler::handleIceCandidate(const QJsonValue &payload) {
     }
 
     // Sets the remote session description (does not take ownership).
-    m_conductor->addRemoteIceCandidate(ice_candidate.get());
+    conductor(client_id)->addRemoteIceCandidate(ice_candidate.get());
 }
 
-void ControlServerHandler::handleSessionDescription(const QJsonValue &payload) {
+void ControlServerHandler::handleSessionDescription(quintptr client_id,
+                                                    const QJsonValue &payload) {
     if (!payload.isObject()) {
         qWarning() << "Invalid session description payload";
         return;
@@ -184,7 +368,7 @@ void ControlServerHandler::handleSessionDescription(const QJsonValue &payload) {
     }
 
     // Sets the remote session description.
-    m_conductor->setRemoteDescription(session_description); // Takes ownership.
+    conductor(client_id)->setRemoteDescription(session_description); // Takes ownership.
 }
 
 } // namespace webrtc
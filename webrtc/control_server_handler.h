@@ -1,41 +1,101 @@
 #ifndef WEBRTC_CONTROL_SERVER_HANDLER_H
 #define WEBRTC_CONTROL_SERVER_HANDLER_H
 
+#include <cstdint>
+
+#include <QtCore/QHash>
+#include <QtCore/QJsonArray>
 #include <QtCore/QObject>
+#include <QtCore/QScopedPointer>
+#include <QtCore/QSet>
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+#include <webrtc/base/scoped_ref_ptr.h>
+#pragma GCC diagnostic pop
 
 class ControlServer;
 class QJsonValue;
 
 namespace webrtc {
 
+class BitrateTuner;
 class Conductor;
 class IceCandidateInterface;
+class PAAudioDeviceModule;
+class PeerConnectionFactoryInterface;
 class SessionDescriptionInterface;
 
+// Translates between the control-server messages and the per-client
+// conductors. Every connected client gets its own conductor (and thereby
+// its own peer connection); they all share the given factory.
 class ControlServerHandler : public QObject {
     Q_OBJECT
 
 public:
-    ControlServerHandler(ControlServer *control_server, Conductor *conductor);
+    ControlServerHandler(ControlServer *control_server,
+                         PeerConnectionFactoryInterface *factory,
+                         PAAudioDeviceModule *adm);
     ~ControlServerHandler();
 
 private Q_SLOTS:
-    void onClientConnected();
-    void onMessage(const QString &type, const QJsonValue &payload);
+    void onClientConnected(quintptr client_id);
+    void onClientDisconnected(quintptr client_id);
+    void onMessage(quintptr client_id, const QString &type,
+                   const QJsonValue &payload);
 
 private:
-    void sendIceCandidate(const IceCandidateInterface *ice_candidate);
+    Conductor *conductor(quintptr client_id) const;
+
+    // Candidates are not sent one message each: those appearing within the
+    // batch window are aggregated into a single array-payload message to
+    // avoid a burst of tiny TLS frames during connection setup.
+    void queueIceCandidate(quintptr client_id,
+                           const IceCandidateInterface *ice_candidate);
+    void flushIceCandidates(quintptr client_id);
+
     void sendSessionDescription(
+            quintptr client_id,
             const SessionDescriptionInterface *session_description);
 
-    void handleReset();
-    void handleGetIceCandidates();
-    void handleGetSessionDescription();
-    void handleSessionDescription(const QJsonValue &payload);
-    void handleIceCandidate(const QJsonValue &payload);
+    // Snapshots the flight record whenever the underrun counter moved
+    // since the last stats round, before the ring overwrites the evidence.
+    void checkUnderruns();
+
+    // Pushes a moved bitrate target out to the peers by renegotiating
+    // every conductor; the answers the clients send back are rewritten to
+    // carry the target (see Conductor::setRemoteDescription). Small moves
+    // are skipped so the tuner's probe steps do not renegotiate every
+    // quiet round.
+    void renegotiateBitrate();
+
+    void handleReset(quintptr client_id);
+    void handleGetIceCandidates(quintptr client_id);
+    void handleGetSessionDescription(quintptr client_id);
+    void handleSessionDescription(quintptr client_id,
+                                  const QJsonValue &payload);
+    void handleIceCandidate(quintptr client_id, const QJsonValue &payload);
 
     ControlServer *m_control_server;
-    Conductor *m_conductor;
+    rtc::scoped_refptr<PeerConnectionFactoryInterface> m_factory;
+    rtc::scoped_refptr<PAAudioDeviceModule> m_adm;
+
+    // The underrun count already handled by checkUnderruns().
+    uint64_t m_seen_underruns;
+
+    QHash<quintptr, rtc::scoped_refptr<Conductor> > m_conductors;
+
+    // One tuner for all peers: the encoder is shared, so the worst link
+    // governs the common bitrate target.
+    QScopedPointer<BitrateTuner> m_bitrate_tuner;
+
+    // The target the peers last saw in their SDP; renegotiateBitrate()
+    // only acts when the tuner moved noticeably away from it.
+    int m_negotiated_bit_rate_bps;
+
+    // Per-client candidate batches waiting for their flush timer.
+    QHash<quintptr, QJsonArray> m_pending_candidates;
+    QSet<quintptr> m_flush_scheduled;
 };
 
 } // namespace webrtc
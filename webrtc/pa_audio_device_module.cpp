@@ -3,20 +3,56 @@
 #include <cstring>
 #include <limits>
 
+#include <QtCore/QDateTime>
 #include <QtCore/QDebug>
 #include <QtCore/QMutexLocker>
+#include <QtCore/QScopedPointer>
+#include <QtCore/QThread>
 #include <QtCore/QtGlobal>
 
+#include "flight_recorder.h"
 #include "pa_sink.h"
+#include "sample_ops.h"
+#include "stats.h"
+#include "trace.h"
 
 namespace {
 const char kRecordingDeviceName[] = "PACC";
+
+// How much audio the staging buffer holds, in 10 ms blocks.
+const size_t kStagingCapacityBlocks = 100;
+
+// How many consecutive all-zero 10 ms blocks we tolerate before suspending
+// delivery. 500 blocks equal five seconds; short pauses between tracks stay
+// below that so the encoder is not needlessly cycled.
+const size_t kSilentBlocksBeforeSuspend = 500;
+
+// The wall-clock window over which the CPU load is averaged. One second
+// smooths out the per-block jitter without making the figure stale.
+const qint64 kLoadWindowNsec = 1000000000;
+
+// How much audio the flight-recorder ring file keeps. Thirty seconds of
+// 48 kHz stereo s16 are under 6 MB and comfortably cover the history
+// around an underrun.
+const int kFlightRecordSeconds = 30;
 } // namespace
 
 namespace webrtc {
 
 PAAudioDeviceModule::PAAudioDeviceModule(PASink *pa_sink)
     : m_pa_sink(pa_sink)
+    , m_staging_read(0)
+    , m_staging_filled(0)
+    , m_silent_blocks(0)
+    , m_suspended(false)
+    , m_load_window_start_nsec(0)
+    , m_busy_nsec(0)
+    , m_cpu_load(0)
+    , m_recording_delay_ms(0)
+    , m_flight_recorder(NULL)
+    , m_in_flight_write(false)
+    , m_last_underruns(0)
+    , m_initialized(false)
     , m_recording_initialized(false)
     , m_do_record(false)
     , m_agc(false)
@@ -28,9 +64,40 @@ PAAudioDeviceModule::PAAudioDeviceModule(PASink *pa_sink)
 }
 
 ssize_t PAAudioDeviceModule::write(const void *buf, size_t length) {
-    QMutexLocker l(&m_mutex);
+    // Runs on the delivery thread. Only atomic flags are consulted so the
+    // audio path never contends with the control-plane mutex. The in-write
+    // flag goes up before the record flag is read: the control plane drops
+    // the record flag, then waits for this flag, and only then touches the
+    // staging buffer or the flight recorder (see SetRecordingSampleRate
+    // and dropFlightRecorder); the seq_cst pairing keeps the two sides
+    // from missing each other.
+    m_in_flight_write.store(true, std::memory_order_seq_cst);
+    if (m_do_record.load(std::memory_order_seq_cst) && !m_staging.isEmpty()) {
+        // Clocks the time spent in this path for the CPU load figure.
+        if (!m_load_timer.isValid()) {
+            m_load_timer.start();
+            m_load_window_start_nsec = 0;
+        }
+        const qint64 entered_nsec = m_load_timer.nsecsElapsed();
+
+        // Feeds the raw PCM into the flight recorder before staging and
+        // silence suppression, so the record shows exactly what the sink
+        // delivered. Plain stores into the mapping; no syscalls.
+        FlightRecorder *recorder =
+                m_flight_recorder.load(std::memory_order_seq_cst);
+        if (recorder) {
+            recorder->write(buf, length);
+
+            // Stamps the ring position whenever the global underrun
+            // counter moved so offline tools find the glitch.
+            uint64_t underruns = stats::counters().underruns.load(
+                        std::memory_order_relaxed);
+            if (underruns != m_last_underruns) {
+                m_last_underruns = underruns;
+                recorder->noteUnderrun();
+            }
+        }
 
-    if (m_do_record) {
         // Defines the block size that we must consider when sending data to the
         // audio device buffer.
         // From: webrtc/common_audio/resampler/push_resampler.cc
@@ -45,44 +112,152 @@ ssize_t PAAudioDeviceModule::write(const void *buf, size_t length) {
                 2 * m_audio_device_buffer.RecordingChannels();
         const uint32_t num_samples_per_block = block_size / bytes_per_sample;
 
-        // Adds the data to the remaining buffer.
-        m_remaining_data.append((const char *)buf, length);
+        // Copies the data into the circular staging buffer. Anything beyond
+        // its capacity is dropped; growing the buffer on the audio path
+        // would mean heap traffic we specifically want to avoid.
+        const size_t capacity = (size_t)m_staging.size();
+        size_t fit = qMin(length, capacity - m_staging_filled);
+        size_t write_pos = (m_staging_read + m_staging_filled) % capacity;
+        size_t tail = capacity - write_pos;
+        if (fit <= tail) {
+            memcpy(m_staging.data() + write_pos, buf, fit);
+        } else {
+            memcpy(m_staging.data() + write_pos, buf, tail);
+            memcpy(m_staging.data(), (const char *)buf + tail, fit - tail);
+        }
+        m_staging_filled += fit;
 
         // We send the data in chunks that are digestible by the audio device
-        // buffer.
-        while ((size_t)m_remaining_data.size() >= block_size) {
+        // buffer. Since the capacity is a multiple of the block size a due
+        // block is always contiguous and can be handed over in place.
+        while (m_staging_filled >= block_size) {
+            // Tracks runs of digital silence. A single non-zero block resumes
+            // delivery immediately; suspending only happens after a long
+            // run so short pauses do not cycle the encoder.
+            if (sample_ops::isSilence(m_staging.data() + m_staging_read,
+                                      block_size)) {
+                if (m_silent_blocks < kSilentBlocksBeforeSuspend) {
+                    ++m_silent_blocks;
+                }
+            } else {
+                m_silent_blocks = 0;
+            }
+
+            bool suspend = m_silent_blocks >= kSilentBlocksBeforeSuspend;
+            if (suspend != m_suspended.load(std::memory_order_relaxed)) {
+                m_suspended.store(suspend, std::memory_order_release);
+                if (m_suspend_callback) {
+                    m_suspend_callback(suspend);
+                }
+            }
+
+            if (suspend) {
+                // Drops the silent block without waking the voice engine.
+                stats::counters().suppressed_blocks.fetch_add(
+                            1, std::memory_order_relaxed);
+                m_staging_read = (m_staging_read + block_size) % capacity;
+                m_staging_filled -= block_size;
+                continue;
+            }
+
             int32_t status = m_audio_device_buffer.SetRecordedBuffer(
-                        m_remaining_data.data(), num_samples_per_block);
+                        m_staging.data() + m_staging_read,
+                        num_samples_per_block);
             if (status == -1) {
                 qWarning() << "Failed to set the recorded buffer.";
             }
 
+            // Reports the real capture delay (what is still queued in the
+            // staging buffer) with the block, so the AEC delay estimation
+            // and receiver-side sync work with facts instead of zero.
+            int delay_ms = (int)(m_staging_filled * 10 / block_size);
+            m_audio_device_buffer.SetVQEData(0, delay_ms, 0);
+
             status = m_audio_device_buffer.DeliverRecordedData();
             if (status == -1) {
                 qWarning() << "Failed to deliver the recorded buffer.";
+                stats::counters().deliver_failures.fetch_add(
+                            1, std::memory_order_relaxed);
+            } else {
+                stats::counters().delivered_blocks.fetch_add(
+                            1, std::memory_order_relaxed);
             }
 
-            // Removes the processed data from the remaining buffer.
-            m_remaining_data.remove(0, block_size);
+            // Advances the read index past the processed block.
+            m_staging_read = (m_staging_read + block_size) % capacity;
+            m_staging_filled -= block_size;
+        }
+
+        // Publishes the staging depth for RecordingDelay(). Each queued
+        // block is 10 ms of audio.
+        m_recording_delay_ms.store(
+                    (uint16_t)(m_staging_filled * 10 / block_size),
+                    std::memory_order_release);
+
+        // Accumulates the busy time and folds it into the published load
+        // once per wall-clock window.
+        const qint64 now_nsec = m_load_timer.nsecsElapsed();
+        m_busy_nsec += now_nsec - entered_nsec;
+        const qint64 window_nsec = now_nsec - m_load_window_start_nsec;
+        if (window_nsec >= kLoadWindowNsec) {
+            m_cpu_load.store((uint16_t)(m_busy_nsec * 100 / window_nsec),
+                             std::memory_order_release);
+            m_busy_nsec = 0;
+            m_load_window_start_nsec = now_nsec;
         }
     }
+    m_in_flight_write.store(false, std::memory_order_release);
     return length;
 }
 
+void PAAudioDeviceModule::setSuspendCallback(
+        std::function<void(bool suspended)> callback) {
+    m_suspend_callback = callback;
+}
+
+bool PAAudioDeviceModule::suspended() const {
+    return m_suspended.load(std::memory_order_acquire);
+}
+
+bool PAAudioDeviceModule::snapshotFlightRecord(QString *dest_path) {
+    QMutexLocker l(&m_mutex);
+
+    FlightRecorder *recorder =
+            m_flight_recorder.load(std::memory_order_acquire);
+    if (!recorder) {
+        return false;
+    }
+
+    // The mutex keeps Start/Stop from tearing the recorder down during
+    // the copy; the delivery thread keeps writing, which can tear at most
+    // the newest block (see FlightRecorder::snapshot).
+    QString dest = recorder->path() + "." +
+            QDateTime::currentDateTime().toString("yyyyMMdd-hhmmss") +
+            ".snap";
+    if (!recorder->snapshot(dest)) {
+        return false;
+    }
+
+    if (dest_path) {
+        *dest_path = dest;
+    }
+    return true;
+}
+
 
 int64_t PAAudioDeviceModule::TimeUntilNextProcess() {
-    qDebug() << __FUNCTION__;
+    trace::event<trace::kAdm>(__FUNCTION__);
     return std::numeric_limits<int64_t>::max();
 }
 
 int32_t PAAudioDeviceModule::Process() {
-    qDebug() << __FUNCTION__;
+    trace::event<trace::kAdm>(__FUNCTION__);
     return 0;
 }
 
 // Retrieve the currently utilized audio layer
 int32_t PAAudioDeviceModule::ActiveAudioLayer(AudioLayer *audioLayer) const {
-    qDebug() << __FUNCTION__;
+    trace::event<trace::kAdm>(__FUNCTION__);
     *audioLayer = kPlatformDefaultAudio;
     return 0;
 }
@@ -93,7 +268,7 @@ AudioDeviceModule::ErrorCode PAAudioDeviceModule::LastError() const {
 }
 int32_t PAAudioDeviceModule::RegisterEventObserver(
         AudioDeviceObserver *eventCallback) {
-    qDebug() << __FUNCTION__;
+    trace::event<trace::kAdm>(__FUNCTION__);
     // We currently do not do any error handling.
     Q_UNUSED(eventCallback);
     return 0;
@@ -102,44 +277,45 @@ int32_t PAAudioDeviceModule::RegisterEventObserver(
 // Full-duplex transportation of PCM audio
 int32_t PAAudioDeviceModule::RegisterAudioCallback(
         AudioTransport *audioCallback) {
-    qDebug() << __FUNCTION__;
+    trace::event<trace::kAdm>(__FUNCTION__);
     return m_audio_device_buffer.RegisterAudioCallback(audioCallback);
 }
 
 // Main initialization and termination
 int32_t PAAudioDeviceModule::Init() {
-    qDebug() << __FUNCTION__;
+    trace::event<trace::kAdm>(__FUNCTION__);
     QMutexLocker l(&m_mutex);
 
     m_initialized = true;
     return 0;
 }
 int32_t PAAudioDeviceModule::Terminate() {
-    qDebug() << __FUNCTION__;
+    trace::event<trace::kAdm>(__FUNCTION__);
     QMutexLocker l(&m_mutex);
 
+    dropFlightRecorder();
     m_initialized = false;
     return 0;
 }
 bool PAAudioDeviceModule::Initialized() const {
-    qDebug() << __FUNCTION__;
+    trace::event<trace::kAdm>(__FUNCTION__);
     QMutexLocker l(&m_mutex);
     return m_initialized;
 }
 
 // Device enumeration
 int16_t PAAudioDeviceModule::PlayoutDevices() {
-    qDebug() << __FUNCTION__;
+    trace::event<trace::kAdm>(__FUNCTION__);
     return 0; // There are no playout devices.
 }
 int16_t PAAudioDeviceModule::RecordingDevices() {
-    qDebug() << __FUNCTION__;
+    trace::event<trace::kAdm>(__FUNCTION__);
     return 1;
 }
 int32_t PAAudioDeviceModule::PlayoutDeviceName(uint16_t index,
                                                char name[kAdmMaxDeviceNameSize],
                                                char guid[kAdmMaxGuidSize]) {
-    qDebug() << __FUNCTION__;
+    trace::event<trace::kAdm>(__FUNCTION__);
     Q_UNUSED(index);
 
     if (name != NULL) {
@@ -155,7 +331,7 @@ int32_t PAAudioDeviceModule::PlayoutDeviceName(uint16_t index,
 int32_t PAAudioDeviceModule::RecordingDeviceName(
         uint16_t index, char name[kAdmMaxDeviceNameSize],
         char guid[kAdmMaxGuidSize]) {
-    qDebug() << __FUNCTION__;
+    trace::event<trace::kAdm>(__FUNCTION__);
     if (index != 0 || name == NULL) {
         return -1;
     }
@@ -173,77 +349,85 @@ int32_t PAAudioDeviceModule::RecordingDeviceName(
 
 // Device selection
 int32_t PAAudioDeviceModule::SetPlayoutDevice(uint16_t index) {
-    qDebug() << __FUNCTION__ << " " << index;
+    trace::event<trace::kAdm>(__FUNCTION__, index);
     Q_UNUSED(index);
     // Currently it is set despite the fact that we promote no playout devices.
     return 0;
 }
 int32_t PAAudioDeviceModule::SetPlayoutDevice(WindowsDeviceType device) {
-    qDebug() << __FUNCTION__;
+    trace::event<trace::kAdm>(__FUNCTION__);
     Q_UNUSED(device);
     return -1;
 }
 int32_t PAAudioDeviceModule::SetRecordingDevice(uint16_t index) {
-    qDebug() << __FUNCTION__ << " " << index;
+    trace::event<trace::kAdm>(__FUNCTION__, index);
     return index == 0 ? 0 : -1;
 }
 int32_t PAAudioDeviceModule::SetRecordingDevice(WindowsDeviceType device) {
-    qDebug() << __FUNCTION__;
+    trace::event<trace::kAdm>(__FUNCTION__);
     Q_UNUSED(device);
     return -1;
 }
 
 // Audio transport initialization
 int32_t PAAudioDeviceModule::PlayoutIsAvailable(bool *available) {
-    qDebug() << __FUNCTION__;
+    trace::event<trace::kAdm>(__FUNCTION__);
     *available = false;
     return 0;
 }
 int32_t PAAudioDeviceModule::InitPlayout() {
-    qDebug() << __FUNCTION__;
+    trace::event<trace::kAdm>(__FUNCTION__);
     return -1;
 }
 bool PAAudioDeviceModule::PlayoutIsInitialized() const {
-    qDebug() << __FUNCTION__;
+    trace::event<trace::kAdm>(__FUNCTION__);
     return false;
 }
 int32_t PAAudioDeviceModule::RecordingIsAvailable(bool *available) {
-    qDebug() << __FUNCTION__;
+    trace::event<trace::kAdm>(__FUNCTION__);
     *available = true;
     return 0;
 }
 int32_t PAAudioDeviceModule::InitRecording() {
-    qDebug() << __FUNCTION__;
+    trace::event<trace::kAdm>(__FUNCTION__);
     QMutexLocker l(&m_mutex);
     m_recording_initialized = true;
 
-    // TODO: get sample rate from PASink
     m_audio_device_buffer.SetRecordingSampleRate(m_pa_sink->sampleRateHz());
+
+    // Preallocates the staging buffer. See write() for the block-size math.
+    const size_t block_size =
+            m_audio_device_buffer.RecordingSampleRate() * 2 *
+            m_audio_device_buffer.RecordingChannels() / 100;
+    m_staging.resize(kStagingCapacityBlocks * block_size);
+    m_staging_read = 0;
+    m_staging_filled = 0;
+
     return m_audio_device_buffer.InitRecording();
 }
 bool PAAudioDeviceModule::RecordingIsInitialized() const {
-    qDebug() << __FUNCTION__;
+    trace::event<trace::kAdm>(__FUNCTION__);
     QMutexLocker l(&m_mutex);
     return m_recording_initialized;
 }
 
 // Audio transport control
 int32_t PAAudioDeviceModule::StartPlayout() {
-    qDebug() << __FUNCTION__;
+    trace::event<trace::kAdm>(__FUNCTION__);
     return -1;
 }
 int32_t PAAudioDeviceModule::StopPlayout() {
-    qDebug() << __FUNCTION__;
+    trace::event<trace::kAdm>(__FUNCTION__);
     // Gets called even if no playout is running and we do not even support
     // playout.
     return 0;
 }
 bool PAAudioDeviceModule::Playing() const {
-    qDebug() << __FUNCTION__;
+    trace::event<trace::kAdm>(__FUNCTION__);
     return false;
 }
 int32_t PAAudioDeviceModule::StartRecording() {
-    qDebug() << __FUNCTION__;
+    trace::event<trace::kAdm>(__FUNCTION__);
     QMutexLocker l(&m_mutex);
     if (!m_recording_initialized) {
         return -1;
@@ -253,39 +437,39 @@ int32_t PAAudioDeviceModule::StartRecording() {
     return 0;
 }
 int32_t PAAudioDeviceModule::StopRecording() {
-    qDebug() << __FUNCTION__;
+    trace::event<trace::kAdm>(__FUNCTION__);
     QMutexLocker l(&m_mutex);
     m_do_record = false;
     return 0;
 }
 bool PAAudioDeviceModule::Recording() const {
-    qDebug() << __FUNCTION__;
+    trace::event<trace::kAdm>(__FUNCTION__);
     QMutexLocker l(&m_mutex);
     return m_do_record;
 }
 
 // Microphone Automatic Gain Control (AGC)
 int32_t PAAudioDeviceModule::SetAGC(bool enable) {
-    qDebug() << __FUNCTION__ << " " << enable;
+    trace::event<trace::kAdm>(__FUNCTION__, enable);
     m_agc = enable;
     return 0;
 }
 bool PAAudioDeviceModule::AGC() const {
-    qDebug() << __FUNCTION__;
+    trace::event<trace::kAdm>(__FUNCTION__);
     return m_agc;
 }
 
 // Volume control based on the Windows Wave API (Windows only)
 int32_t PAAudioDeviceModule::SetWaveOutVolume(uint16_t volumeLeft,
                                               uint16_t volumeRight) {
-    qDebug() << __FUNCTION__;
+    trace::event<trace::kAdm>(__FUNCTION__);
     Q_UNUSED(volumeLeft);
     Q_UNUSED(volumeRight);
     return -1;
 }
 int32_t PAAudioDeviceModule::WaveOutVolume(uint16_t *volumeLeft,
                                            uint16_t *volumeRight) const {
-    qDebug() << __FUNCTION__;
+    trace::event<trace::kAdm>(__FUNCTION__);
     Q_UNUSED(volumeLeft);
     Q_UNUSED(volumeRight);
     return -1;
@@ -293,161 +477,161 @@ int32_t PAAudioDeviceModule::WaveOutVolume(uint16_t *volumeLeft,
 
 // Audio mixer initialization
 int32_t PAAudioDeviceModule::InitSpeaker() {
-    qDebug() << __FUNCTION__;
+    trace::event<trace::kAdm>(__FUNCTION__);
     return 0;
 }
 bool PAAudioDeviceModule::SpeakerIsInitialized() const {
-    qDebug() << __FUNCTION__;
+    trace::event<trace::kAdm>(__FUNCTION__);
     return true;
 }
 int32_t PAAudioDeviceModule::InitMicrophone() {
-    qDebug() << __FUNCTION__;
+    trace::event<trace::kAdm>(__FUNCTION__);
     return 0;
 }
 bool PAAudioDeviceModule::MicrophoneIsInitialized() const {
-    qDebug() << __FUNCTION__;
+    trace::event<trace::kAdm>(__FUNCTION__);
     return true;
 }
 
 // Speaker volume controls
 int32_t PAAudioDeviceModule::SpeakerVolumeIsAvailable(bool *available) {
-    qDebug() << __FUNCTION__;
+    trace::event<trace::kAdm>(__FUNCTION__);
     Q_UNUSED(available);
     return -1;
 }
 int32_t PAAudioDeviceModule::SetSpeakerVolume(uint32_t volume) {
-    qDebug() << __FUNCTION__;
+    trace::event<trace::kAdm>(__FUNCTION__);
     Q_UNUSED(volume);
     return -1;
 }
 int32_t PAAudioDeviceModule::SpeakerVolume(uint32_t *volume) const {
-    qDebug() << __FUNCTION__;
+    trace::event<trace::kAdm>(__FUNCTION__);
     Q_UNUSED(volume);
     return -1;
 }
 int32_t PAAudioDeviceModule::MaxSpeakerVolume(uint32_t *maxVolume) const {
-    qDebug() << __FUNCTION__;
+    trace::event<trace::kAdm>(__FUNCTION__);
     Q_UNUSED(maxVolume);
     return -1;
 }
 int32_t PAAudioDeviceModule::MinSpeakerVolume(uint32_t *minVolume) const {
-    qDebug() << __FUNCTION__;
+    trace::event<trace::kAdm>(__FUNCTION__);
     Q_UNUSED(minVolume);
     return -1;
 }
 int32_t PAAudioDeviceModule::SpeakerVolumeStepSize(uint16_t *stepSize) const {
-    qDebug() << __FUNCTION__;
+    trace::event<trace::kAdm>(__FUNCTION__);
     Q_UNUSED(stepSize);
     return -1;
 }
 
 // Microphone volume controls
 int32_t PAAudioDeviceModule::MicrophoneVolumeIsAvailable(bool *available) {
-    qDebug() << __FUNCTION__;
+    trace::event<trace::kAdm>(__FUNCTION__);
     *available = false;
     return 0;
 }
 int32_t PAAudioDeviceModule::SetMicrophoneVolume(uint32_t volume) {
-    qDebug() << __FUNCTION__;
+    trace::event<trace::kAdm>(__FUNCTION__);
     Q_UNUSED(volume);
     return -1;
 }
 int32_t PAAudioDeviceModule::MicrophoneVolume(uint32_t *volume) const {
-    qDebug() << __FUNCTION__;
+    trace::event<trace::kAdm>(__FUNCTION__);
     *volume = m_pa_sink->volume();
     return 0;
 }
 int32_t PAAudioDeviceModule::MaxMicrophoneVolume(uint32_t *maxVolume) const {
-    qDebug() << __FUNCTION__;
+    trace::event<trace::kAdm>(__FUNCTION__);
 	*maxVolume = m_pa_sink->maxVolume();
     return 0;
 }
 int32_t PAAudioDeviceModule::MinMicrophoneVolume(uint32_t *minVolume) const {
-    qDebug() << __FUNCTION__;
+    trace::event<trace::kAdm>(__FUNCTION__);
     *minVolume = m_pa_sink->minVolume();
     return 0;
 }
 int32_t PAAudioDeviceModule::MicrophoneVolumeStepSize(uint16_t *stepSize) const {
-    qDebug() << __FUNCTION__;
+    trace::event<trace::kAdm>(__FUNCTION__);
     *stepSize = m_pa_sink->volumeStepSize();
     return 0;
 }
 
 // Speaker mute control
 int32_t PAAudioDeviceModule::SpeakerMuteIsAvailable(bool *available) {
-    qDebug() << __FUNCTION__;
+    trace::event<trace::kAdm>(__FUNCTION__);
     Q_UNUSED(available);
     return -1;
 }
 int32_t PAAudioDeviceModule::SetSpeakerMute(bool enable) {
-    qDebug() << __FUNCTION__;
+    trace::event<trace::kAdm>(__FUNCTION__);
     Q_UNUSED(enable);
     return -1;
 }
 int32_t PAAudioDeviceModule::SpeakerMute(bool *enabled) const {
-    qDebug() << __FUNCTION__;
+    trace::event<trace::kAdm>(__FUNCTION__);
     Q_UNUSED(enabled);
     return -1;
 }
 
 // Microphone mute control
 int32_t PAAudioDeviceModule::MicrophoneMuteIsAvailable(bool *available) {
-    qDebug() << __FUNCTION__;
+    trace::event<trace::kAdm>(__FUNCTION__);
     *available = false;
     return 0;
 }
 int32_t PAAudioDeviceModule::SetMicrophoneMute(bool enable) {
-    qDebug() << __FUNCTION__;
+    trace::event<trace::kAdm>(__FUNCTION__);
     Q_UNUSED(enable);
     return -1;
 }
 int32_t PAAudioDeviceModule::MicrophoneMute(bool *enabled) const {
-    qDebug() << __FUNCTION__;
+    trace::event<trace::kAdm>(__FUNCTION__);
     *enabled = m_pa_sink->isMuted();
     return 0;
 }
 
 // Microphone boost control
 int32_t PAAudioDeviceModule::MicrophoneBoostIsAvailable(bool *available) {
-    qDebug() << __FUNCTION__;
+    trace::event<trace::kAdm>(__FUNCTION__);
     *available = false;
     return 0;
 }
 int32_t PAAudioDeviceModule::SetMicrophoneBoost(bool enable) {
-    qDebug() << __FUNCTION__;
+    trace::event<trace::kAdm>(__FUNCTION__);
     Q_ASSERT(enable == false);
     return 0;
 }
 int32_t PAAudioDeviceModule::MicrophoneBoost(bool *enabled) const {
-    qDebug() << __FUNCTION__;
+    trace::event<trace::kAdm>(__FUNCTION__);
     *enabled = false;
     return 0;
 }
 
 // Stereo support
 int32_t PAAudioDeviceModule::StereoPlayoutIsAvailable(bool *available) const {
-    qDebug() << __FUNCTION__;
+    trace::event<trace::kAdm>(__FUNCTION__);
     *available = false;
     return 0;
 }
 int32_t PAAudioDeviceModule::SetStereoPlayout(bool enable) {
-    qDebug() << __FUNCTION__;
+    trace::event<trace::kAdm>(__FUNCTION__);
     Q_UNUSED(enable);
     return 0;
 }
 int32_t PAAudioDeviceModule::StereoPlayout(bool *enabled) const {
-    qDebug() << __FUNCTION__;
+    trace::event<trace::kAdm>(__FUNCTION__);
     Q_UNUSED(enabled);
     return -1;
 }
 
 int32_t PAAudioDeviceModule::StereoRecordingIsAvailable(bool *available) const {
-    qDebug() << __FUNCTION__;
+    trace::event<trace::kAdm>(__FUNCTION__);
     *available = m_pa_sink->numChannels() == 2;
     return 0;
 }
 int32_t PAAudioDeviceModule::SetStereoRecording(bool enable) {
-    qDebug() << __FUNCTION__ << " " << enable;
+    trace::event<trace::kAdm>(__FUNCTION__, enable);
     QMutexLocker l(&m_mutex);
     uint8_t num_channels = enable ? 2 : 1;
     Q_ASSERT(num_channels == m_pa_sink->numChannels());
@@ -455,113 +639,184 @@ int32_t PAAudioDeviceModule::SetStereoRecording(bool enable) {
     return 0;
 }
 int32_t PAAudioDeviceModule::StereoRecording(bool *enabled) const {
-    qDebug() << __FUNCTION__;
+    trace::event<trace::kAdm>(__FUNCTION__);
     *enabled = m_audio_device_buffer.RecordingChannels() == 2;
     return 0;
 }
 int32_t PAAudioDeviceModule::SetRecordingChannel(const ChannelType channel) {
-    qDebug() << __FUNCTION__ << " " << channel;
+    trace::event<trace::kAdm>(__FUNCTION__, channel);
     return m_audio_device_buffer.SetRecordingChannel(channel);
 }
 int32_t PAAudioDeviceModule::RecordingChannel(ChannelType *channel) const {
-    qDebug() << __FUNCTION__;
+    trace::event<trace::kAdm>(__FUNCTION__);
     return m_audio_device_buffer.RecordingChannel(*channel);
 }
 
 // Delay information and control
 int32_t PAAudioDeviceModule::SetPlayoutBuffer(const BufferType type,
                                               uint16_t sizeMS) {
-    qDebug() << __FUNCTION__;
+    trace::event<trace::kAdm>(__FUNCTION__);
     Q_UNUSED(type);
     Q_UNUSED(sizeMS);
     return -1;
 }
 int32_t PAAudioDeviceModule::PlayoutBuffer(BufferType *type,
                                            uint16_t *sizeMS) const {
-    qDebug() << __FUNCTION__;
+    trace::event<trace::kAdm>(__FUNCTION__);
     Q_UNUSED(type);
     Q_UNUSED(sizeMS);
     return -1;
 }
 int32_t PAAudioDeviceModule::PlayoutDelay(uint16_t *delayMS) const {
-    qDebug() << __FUNCTION__;
+    trace::event<trace::kAdm>(__FUNCTION__);
     Q_UNUSED(delayMS);
     return -1;
 }
 int32_t PAAudioDeviceModule::RecordingDelay(uint16_t *delayMS) const {
-    qDebug() << __FUNCTION__;
-    // TODO
-    *delayMS = 0;
+    trace::event<trace::kAdm>(__FUNCTION__);
+    // The audio queued in the staging buffer, as published by the delivery
+    // thread after each write.
+    *delayMS = m_recording_delay_ms.load(std::memory_order_acquire);
     return 0;
 }
 
 // CPU load
 int32_t PAAudioDeviceModule::CPULoad(uint16_t *load) const {
-    qDebug() << __FUNCTION__;
-    Q_UNUSED(load);
-    return -1;
+    trace::event<trace::kAdm>(__FUNCTION__);
+    // Time spent in the write/deliver path per wall-clock window, in
+    // percent.
+    *load = m_cpu_load.load(std::memory_order_acquire);
+    return 0;
 }
 
 // Recording of raw PCM data
 int32_t PAAudioDeviceModule::StartRawOutputFileRecording(
         const char pcmFileNameUTF8[kAdmMaxFileNameSize]) {
-    qDebug() << __FUNCTION__;
+    trace::event<trace::kAdm>(__FUNCTION__);
     Q_UNUSED(pcmFileNameUTF8);
     return -1;
 }
 int32_t PAAudioDeviceModule::StopRawOutputFileRecording() {
-    qDebug() << __FUNCTION__;
+    trace::event<trace::kAdm>(__FUNCTION__);
     return -1;
 }
 int32_t PAAudioDeviceModule::StartRawInputFileRecording(
         const char pcmFileNameUTF8[kAdmMaxFileNameSize]) {
-    qDebug() << __FUNCTION__;
-    return m_audio_device_buffer.StartInputFileRecording(pcmFileNameUTF8);
+    trace::event<trace::kAdm>(__FUNCTION__);
+    QMutexLocker l(&m_mutex);
+
+    // Replaces the voice engine's file recording, whose buffered write()
+    // calls on the delivery path made the very glitches it was meant to
+    // diagnose worse. The mmap-backed ring file keeps the last
+    // kFlightRecordSeconds around at effectively zero delivery-thread
+    // cost, so it can stay enabled in production.
+    dropFlightRecorder();
+
+    const uint32_t sample_rate = m_audio_device_buffer.RecordingSampleRate();
+    const uint8_t num_channels =
+            (uint8_t)m_audio_device_buffer.RecordingChannels();
+    if (sample_rate == 0 || num_channels == 0) {
+        return -1;
+    }
+
+    const size_t capacity =
+            (size_t)sample_rate * num_channels * 2 * kFlightRecordSeconds;
+    QScopedPointer<FlightRecorder> recorder(
+                new FlightRecorder(QString::fromUtf8(pcmFileNameUTF8),
+                                   capacity, sample_rate, num_channels, 2));
+    if (!recorder->isOpen()) {
+        return -1;
+    }
+
+    m_flight_recorder.store(recorder.take(), std::memory_order_release);
+    return 0;
 }
 int32_t PAAudioDeviceModule::StopRawInputFileRecording() {
-    qDebug() << __FUNCTION__;
-    return m_audio_device_buffer.StopInputFileRecording();
+    trace::event<trace::kAdm>(__FUNCTION__);
+    QMutexLocker l(&m_mutex);
+
+    dropFlightRecorder();
+    return 0;
+}
+
+void PAAudioDeviceModule::dropFlightRecorder() {
+    FlightRecorder *stale =
+            m_flight_recorder.exchange(NULL, std::memory_order_seq_cst);
+    if (stale == NULL) {
+        return;
+    }
+
+    // A write() may have loaded the pointer just before the exchange and
+    // still be inside the recorder. Its in-write flag went up before that
+    // load, so once the flag is observed clear here any write started
+    // later sees the NULL pointer and the recorder is safe to free. The
+    // wait is at most one write() worth of memcpy, so spinning beats
+    // handing the stale pointer around for deferred deletion.
+    while (m_in_flight_write.load(std::memory_order_acquire)) {
+        QThread::yieldCurrentThread();
+    }
+    delete stale;
 }
 
 // Native sample rate controls (samples/sec)
 int32_t PAAudioDeviceModule::SetRecordingSampleRate(
         const uint32_t samplesPerSec) {
-    qDebug() << __FUNCTION__;
-    // TODO: could be done, right?
-    Q_UNUSED(samplesPerSec);
-    return -1;
+    trace::event<trace::kAdm>(__FUNCTION__, samplesPerSec);
+    QMutexLocker l(&m_mutex);
+
+    // Quiesces the delivery thread before reallocating the staging buffer
+    // out from under it: recording is paused, and a write() that passed
+    // the record check before the pause is waited out on the in-write
+    // flag (the same handshake dropFlightRecorder uses).
+    const bool was_recording =
+            m_do_record.exchange(false, std::memory_order_seq_cst);
+    while (m_in_flight_write.load(std::memory_order_acquire)) {
+        QThread::yieldCurrentThread();
+    }
+
+    m_audio_device_buffer.SetRecordingSampleRate(samplesPerSec);
+
+    // Re-sizes the staging buffer for the changed block size.
+    const size_t block_size = samplesPerSec * 2 *
+            m_audio_device_buffer.RecordingChannels() / 100;
+    m_staging.resize(kStagingCapacityBlocks * block_size);
+    m_staging_read = 0;
+    m_staging_filled = 0;
+
+    m_do_record.store(was_recording, std::memory_order_release);
+    return 0;
 }
 int32_t PAAudioDeviceModule::RecordingSampleRate(
         uint32_t *samplesPerSec) const {
-    qDebug() << __FUNCTION__;
+    trace::event<trace::kAdm>(__FUNCTION__);
     *samplesPerSec = m_audio_device_buffer.RecordingSampleRate();
     return 0;
 }
 
 int32_t PAAudioDeviceModule::SetPlayoutSampleRate(
         const uint32_t samplesPerSec) {
-    qDebug() << __FUNCTION__;
+    trace::event<trace::kAdm>(__FUNCTION__);
     Q_UNUSED(samplesPerSec);
     return -1;
 }
 int32_t PAAudioDeviceModule::PlayoutSampleRate(uint32_t *samplesPerSec) const {
-    qDebug() << __FUNCTION__;
+    trace::event<trace::kAdm>(__FUNCTION__);
     Q_UNUSED(samplesPerSec);
     return -1;
 }
 
 // Mobile device specific functions
 int32_t PAAudioDeviceModule::ResetAudioDevice() {
-    qDebug() << __FUNCTION__;
+    trace::event<trace::kAdm>(__FUNCTION__);
     return -1;
 }
 int32_t PAAudioDeviceModule::SetLoudspeakerStatus(bool enable) {
-    qDebug() << __FUNCTION__;
+    trace::event<trace::kAdm>(__FUNCTION__);
     Q_UNUSED(enable);
     return -1;
 }
 int32_t PAAudioDeviceModule::GetLoudspeakerStatus(bool *enabled) const {
-    qDebug() << __FUNCTION__;
+    trace::event<trace::kAdm>(__FUNCTION__);
     Q_UNUSED(enabled);
     return -1;
     return -1;
@@ -1,12 +1,18 @@
 #ifndef WEBRTC_PA_AUDIO_DEVICE_MODULE_H
 #define WEBRTC_PA_AUDIO_DEVICE_MODULE_H
 
+#include <atomic>
+#include <functional>
+
 #include <webrtc/modules/audio_device/audio_device_buffer.h>
 #include <webrtc/modules/audio_device/include/audio_device.h>
 
 #include <QtCore/QByteArray>
+#include <QtCore/QElapsedTimer>
 #include <QtCore/QMutex>
+#include <QtCore/QString>
 
+class FlightRecorder;
 class PASink;
 
 namespace webrtc {
@@ -17,6 +23,22 @@ public:
 
     ssize_t write(const void *buf, size_t length);
 
+    // Registers a callback that is invoked from the delivery thread whenever
+    // the silence suppressor suspends or resumes delivery. Must be set before
+    // recording starts.
+    void setSuspendCallback(std::function<void(bool suspended)> callback);
+
+    // Returns whether delivery is currently suspended because the sink only
+    // renders digital silence.
+    bool suspended() const;
+
+    // Writes a linearized, timestamped copy of the flight-recorder ring
+    // next to the ring file and reports its path, preserving the audio
+    // around a glitch before the ring overwrites it. Copies the whole
+    // ring, so it must only be called from the control plane; returns
+    // false when no recorder is active.
+    bool snapshotFlightRecord(QString *dest_path);
+
 public: // Module
     // Returns the number of milliseconds until the module wants a worker
     // thread to call Process.
@@ -163,14 +185,59 @@ public: // AudioDeviceModule
     int32_t GetLoudspeakerStatus(bool *enabled) const override;
 
 private:
+    // Swaps the recorder out and waits for a delivery-thread write that
+    // raced the swap to leave it before freeing. Must be called with
+    // m_mutex held.
+    void dropFlightRecorder();
+
     PASink *m_pa_sink;
-    QByteArray m_remaining_data;
+
+    // Preallocated circular staging buffer for the incoming audio. Sized at
+    // InitRecording() time to a multiple of the 10 ms block size so a block
+    // that is due for delivery is always contiguous. Only touched from the
+    // delivery thread.
+    QByteArray m_staging;
+    size_t m_staging_read;
+    size_t m_staging_filled;
+
     AudioDeviceBuffer m_audio_device_buffer;
 
+    // Silence suppressor state. The block counter is only touched from the
+    // delivery thread; the suspended flag is readable from anywhere.
+    size_t m_silent_blocks;
+    std::atomic<bool> m_suspended;
+    std::function<void(bool suspended)> m_suspend_callback;
+
+    // Load and delay measurement. The timer and the accumulators are only
+    // touched from the delivery thread; the published values are atomics so
+    // CPULoad()/RecordingDelay() can be answered from any thread.
+    QElapsedTimer m_load_timer;
+    qint64 m_load_window_start_nsec;
+    qint64 m_busy_nsec;
+    std::atomic<uint16_t> m_cpu_load;
+    std::atomic<uint16_t> m_recording_delay_ms;
+
+    // Optional flight recorder for the raw PCM (see
+    // StartRawInputFileRecording). Created and destroyed on the control
+    // plane; the delivery thread only consults the atomic pointer, so the
+    // hot path stays lock and syscall free. The in-write flag brackets
+    // the whole write() path; the control plane spins on it after
+    // withdrawing the recorder pointer or the record flag, so neither the
+    // recorder nor the staging buffer is ever torn down under a write
+    // that is already past the checks (see dropFlightRecorder and
+    // SetRecordingSampleRate). The underrun shadow counter lets the
+    // delivery thread detect trips of the global counter.
+    std::atomic<FlightRecorder *> m_flight_recorder;
+    std::atomic<bool> m_in_flight_write;
+    uint64_t m_last_underruns;
+
+    // Serializes the control-plane calls. The write path never takes it; it
+    // only reads the atomic flags below so the audio delivery never blocks
+    // on signaling.
     mutable QMutex m_mutex;
-    bool m_initialized;
-    bool m_recording_initialized;
-    bool m_do_record;
+    std::atomic<bool> m_initialized;
+    std::atomic<bool> m_recording_initialized;
+    std::atomic<bool> m_do_record;
     bool m_agc;
 };
 
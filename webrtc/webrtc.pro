@@ -104,6 +104,7 @@ INCLUDEPATH +=  \
     .. \
 
 HEADERS += \
+    bitrate_tuner.h \
     conductor.h \
     control_server_handler.h \
     pa_audio_device_module.h \
@@ -111,6 +112,7 @@ HEADERS += \
     writer_webrtc_priv.h \
 
 SOURCES += \
+    bitrate_tuner.cpp \
     conductor.cpp \
     control_server_handler.cpp \
     pa_audio_device_module.cpp \
@@ -4,27 +4,200 @@
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wunused-parameter"
 #include <webrtc/base/scoped_ref_ptr.h>
+#include <webrtc/base/socketserver.h>
 #include <webrtc/base/ssladapter.h>
 #include <webrtc/base/thread.h>
 #pragma GCC diagnostic pop
 
 #include <QtCore/QCoreApplication>
+#include <QtCore/QEventLoop>
+#include <QtCore/QMutex>
+#include <QtCore/QMutexLocker>
+#include <QtCore/QSemaphore>
 #include <QtCore/QThread>
+#include <QtCore/QTimer>
 
 #include "conductor.h"
 #include "control_server.h"
 #include "control_server_handler.h"
 #include "pa_audio_device_module.h"
+#include "pa_sink.h"
+#include "spsc_ring_buffer.h"
+#include "stats.h"
+#include "thread_config.h"
 
 namespace {
 const pa_sample_format_t kSampleFormat = PA_SAMPLE_S16LE;
+
+// How much audio the hand-off ring between the sink thread and the delivery
+// thread can hold. Matches the sink's block budget of two seconds.
+const int kRingCapacitySec = 2;
 } // namespace
 
+// Bridges the rtc message queue with the Qt event loop. rtc::Thread calls
+// Wait() whenever it runs out of messages; instead of sleeping we run the
+// Qt event loop until either the timeout expires or WakeUp() announces a
+// new rtc message. That way both queues are drained on demand: signaling
+// is serviced immediately and an idle thread consumes no CPU.
+class QtSocketServer : public rtc::SocketServer {
+public:
+    QtSocketServer()
+        : m_event_loop(NULL)
+        , m_wake_pending(false)
+    {
+    }
+
+    // SocketFactory implementation. The signaling thread never creates
+    // physical sockets (those live on the rtc worker thread), so none are
+    // provided here; compare rtc::NullSocketServer.
+    rtc::Socket *CreateSocket(int type) override {
+        Q_UNUSED(type);
+        return NULL;
+    }
+    rtc::Socket *CreateSocket(int family, int type) override {
+        Q_UNUSED(family);
+        Q_UNUSED(type);
+        return NULL;
+    }
+    rtc::AsyncSocket *CreateAsyncSocket(int type) override {
+        Q_UNUSED(type);
+        return NULL;
+    }
+    rtc::AsyncSocket *CreateAsyncSocket(int family, int type) override {
+        Q_UNUSED(family);
+        Q_UNUSED(type);
+        return NULL;
+    }
+
+    bool Wait(int cms, bool process_io) override {
+        Q_UNUSED(process_io);
+
+        QEventLoop event_loop;
+        {
+            QMutexLocker l(&m_mutex);
+            if (m_wake_pending) {
+                // A wake-up arrived before we started waiting.
+                m_wake_pending = false;
+                return true;
+            }
+            m_event_loop = &event_loop;
+        }
+
+        QTimer timer;
+        if (cms != rtc::kForever) {
+            timer.setSingleShot(true);
+            QObject::connect(&timer, &QTimer::timeout,
+                             &event_loop, &QEventLoop::quit);
+            timer.start(cms);
+        }
+
+        event_loop.exec();
+
+        QMutexLocker l(&m_mutex);
+        m_event_loop = NULL;
+        m_wake_pending = false;
+        return true;
+    }
+
+    void WakeUp() override {
+        // May be called from any thread.
+        QMutexLocker l(&m_mutex);
+        if (m_event_loop) {
+            // Queued on purpose: a direct exit() racing the window between
+            // Wait() publishing the loop and exec() starting would be
+            // discarded (exec resets the exit flag on entry) and the wakeup
+            // lost. A queued quit sits in the thread's event queue and is
+            // delivered once exec() runs; if the loop is already running it
+            // quits just the same.
+            QMetaObject::invokeMethod(m_event_loop, "quit",
+                                      Qt::QueuedConnection);
+        } else {
+            m_wake_pending = true;
+        }
+    }
+
+private:
+    QMutex m_mutex;
+    QEventLoop *m_event_loop;
+    bool m_wake_pending;
+};
+
+// Moves audio blocks from the hand-off ring into the audio device module.
+// Runs on its own thread so the real-time sink thread never has to wait for
+// the WebRTC control plane.
+class DeliveryThread : public QThread {
+public:
+    DeliveryThread(SpscRingBuffer *ring, webrtc::PAAudioDeviceModule *adm,
+                   size_t byte_rate)
+        : m_ring(ring)
+        , m_adm(adm)
+        , m_byte_rate(byte_rate)
+        , m_stopping(false)
+    {
+        // Preallocated working buffer covering 100 ms of audio; the
+        // delivery loop performs no heap allocations at all.
+        m_block.resize((int)(byte_rate / 10));
+    }
+
+    // Called by the producer after it wrote to the ring.
+    void notify() {
+        m_available.release();
+    }
+
+    void stop() {
+        m_stopping.store(true, std::memory_order_release);
+        m_available.release();
+        wait();
+    }
+
+protected:
+    void run() override {
+        thread_config::applyToCurrentThread("pacc-delivery");
+
+        for (;;) {
+            m_available.acquire();
+            if (m_stopping.load(std::memory_order_acquire)) {
+                break;
+            }
+
+            // The ring depth right before delivery is how long the oldest
+            // pending audio has been waiting.
+            size_t fill = m_ring->availableForRead();
+            stats::counters().buffer_fill_bytes.store(
+                        fill, std::memory_order_relaxed);
+            if (fill > 0) {
+                stats::renderToDeliverLatency().record(
+                            (uint64_t)fill * 1000000 / m_byte_rate);
+            }
+
+            size_t length;
+            while ((length = m_ring->read(m_block.data(),
+                                          (size_t)m_block.size())) > 0) {
+                m_adm->write(m_block.data(), length);
+            }
+        }
+    }
+
+private:
+    SpscRingBuffer *m_ring;
+    webrtc::PAAudioDeviceModule *m_adm;
+    size_t m_byte_rate;
+
+    // Working buffer for the ring reads. Only touched from this thread.
+    QByteArray m_block;
+
+    QSemaphore m_available;
+    std::atomic<bool> m_stopping;
+};
+
 class WebRTCWriterPriv {
 public:
     QThread thread;
     rtc::scoped_refptr<webrtc::PAAudioDeviceModule> adm;
     QScopedPointer<Worker> worker;
+
+    QScopedPointer<SpscRingBuffer> ring;
+    QScopedPointer<DeliveryThread> delivery_thread;
 };
 
 WebRTCWriter::WebRTCWriter(PASink *pa_sink, ControlServer *control_server)
@@ -32,15 +205,37 @@ WebRTCWriter::WebRTCWriter(PASink *pa_sink, ControlServer *control_server)
     , d(new WebRTCWriterPriv)
 {
     d->adm = new rtc::RefCountedObject<webrtc::PAAudioDeviceModule>(pa_sink);
+
+    // Tells the receivers when the silence suppressor pauses or resumes the
+    // stream so they can show it as idle instead of stalled. sendMessage is
+    // safe to call from the delivery thread.
+    d->adm->setSuspendCallback([control_server](bool suspended) {
+        control_server->sendMessage(
+                    suspended ? "streamSuspended" : "streamResumed",
+                    QJsonValue());
+    });
+
     d->worker.reset(new Worker(control_server, d->adm.get()));
 
     d->worker->moveToThread(&d->thread);
     QMetaObject::invokeMethod(d->worker.data(), "run", Qt::QueuedConnection);
 
     d->thread.start();
+
+    // Initializes the lock-free hand-off between the sink thread and the
+    // delivery thread.
+    size_t byte_rate = pa_sink->sampleRateHz() * pa_sink->numChannels() *
+            pa_sample_size_of_format(kSampleFormat);
+    d->ring.reset(new SpscRingBuffer(kRingCapacitySec * byte_rate));
+    d->delivery_thread.reset(new DeliveryThread(d->ring.data(),
+                                                d->adm.get(), byte_rate));
+    d->delivery_thread->start();
 }
 
 WebRTCWriter::~WebRTCWriter() {
+    d->delivery_thread->stop();
+
+    d->worker->stop();
     d->thread.quit();
     d->thread.wait();
 }
@@ -50,7 +245,24 @@ pa_sample_format_t WebRTCWriter::sampleFormat() const {
 }
 
 ssize_t WebRTCWriter::write(const void *buf, size_t length) {
-    return d->adm->write(buf, length);
+    // Hands the block over to the delivery thread without ever blocking.
+    // Should the ring be full the overflow is dropped; stalling the
+    // real-time sink thread would be worse than losing some audio.
+    size_t written = d->ring->write(buf, length);
+    if (written < length) {
+        stats::counters().dropped_bytes.fetch_add(
+                    length - written, std::memory_order_relaxed);
+    }
+    d->delivery_thread->notify();
+    return length;
+}
+
+size_t WebRTCWriter::rewindNative(size_t length) {
+    // Reclaims from the hand-off ring; blocks the delivery thread already
+    // moved into the voice engine are beyond reach. With the adaptive
+    // block budget most of the buffered audio sits in the ring, so this
+    // covers nearly the whole rewindable span.
+    return d->ring->unwrite(length);
 }
 
 /********************************* WORKER *************************************/
@@ -60,31 +272,53 @@ Worker::~Worker() {
 
 void Worker::run() {
     // Runs in own thread.
+    thread_config::applyToCurrentThread("pacc-rtc-signaling");
 
-    // Initializes the rtc thread.
-    rtc::AutoThread auto_thread;
+    // Initializes the rtc thread. Its socket server bridges the rtc message
+    // queue with the Qt event loop so both are drained on demand instead of
+    // being polled.
+    QtSocketServer socket_server;
+    rtc::AutoThread auto_thread(&socket_server);
     rtc::Thread *thread = rtc::Thread::Current();
+    m_thread.store(thread);
 
     rtc::InitializeSSL();
 
-    // Initializes the conductor.
-    rtc::scoped_refptr<webrtc::Conductor> conductor(
-                new rtc::RefCountedObject<webrtc::Conductor>(m_adm));
+    freopen("/tmp/stdout.log", "w", stdout);
+    freopen("/tmp/stderr.log", "w", stderr);
 
-    // Initializes the control-server handler.
-    webrtc::ControlServerHandler control_server_handler(m_control_server,
-                                                        conductor.get());
+    // Initializes the shared peer-connection factory. All conductors (one
+    // per connected client) share it and thereby the audio device module:
+    // the voice engine fans the captured stream out to every peer, so one
+    // slow peer cannot hold back the others or the sink thread.
+    QScopedPointer<rtc::Thread> worker_thread(new rtc::Thread);
+    worker_thread->Start();
+    worker_thread->Invoke<void>([]() {
+        thread_config::applyToCurrentThread("pacc-rtc-worker");
+    });
+    rtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> factory =
+            webrtc::CreatePeerConnectionFactory(worker_thread.data(), thread,
+                                                m_adm, NULL, NULL);
+    Q_ASSERT(factory.get() &&
+             "Failed to initialize PeerConnectionFactory");
 
-    for (;;) {
-        // Processes rtc events.
-        bool ok = thread->ProcessMessages(100);
-        if (!ok) {
-            break;
-        }
+    // Initializes the control-server handler which manages the per-client
+    // conductors.
+    webrtc::ControlServerHandler control_server_handler(m_control_server,
+                                                        factory.get(), m_adm);
 
-        // Processes Qt events.
-        QCoreApplication::processEvents();
-    }
+    // Blocks until stop() is called. Qt events are serviced from within
+    // QtSocketServer::Wait() whenever rtc has nothing to do.
+    thread->ProcessMessages(rtc::kForever);
 
+    m_thread.store(NULL);
     rtc::CleanupSSL();
 }
+
+void Worker::stop() {
+    // May be called from any thread.
+    rtc::Thread *thread = m_thread.load();
+    if (thread) {
+        thread->Quit();
+    }
+}
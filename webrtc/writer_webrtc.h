@@ -16,6 +16,10 @@ public:
 
     pa_sample_format_t sampleFormat() const override;
     ssize_t write(const void *buf, size_t length) override;
+    using BaseWriter::write;
+
+protected:
+    size_t rewindNative(size_t length) override;
 
 private:
     QScopedPointer<WebRTCWriterPriv> d;
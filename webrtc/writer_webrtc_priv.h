@@ -1,30 +1,43 @@
 #ifndef WEBRTC_WRITER_WEBRTC_PRIV_H
 #define WEBRTC_WRITER_WEBRTC_PRIV_H
 
+#include <atomic>
+
 #include <QtCore/QObject>
 
 class ControlServer;
 
+namespace rtc {
+class Thread;
+} // namespace rtc
+
 namespace webrtc {
-class AudioDeviceModule;
+class PAAudioDeviceModule;
 } // namespace webrtc
 
 class Worker : public QObject {
     Q_OBJECT
 
 public:
-    Worker(ControlServer *control_server, webrtc::AudioDeviceModule *adm)
+    Worker(ControlServer *control_server, webrtc::PAAudioDeviceModule *adm)
         : m_control_server(control_server)
         , m_adm(adm)
+        , m_thread(NULL)
     {}
     ~Worker();
 
+    // Asks the rtc thread to leave its message loop. May be called from any
+    // thread.
+    void stop();
+
 public Q_SLOTS:
     void run();
 
 private:
     ControlServer *m_control_server;
-    webrtc::AudioDeviceModule *m_adm;
+    webrtc::PAAudioDeviceModule *m_adm;
+
+    std::atomic<rtc::Thread *> m_thread;
 };
 
 
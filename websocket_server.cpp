@@ -2,6 +2,7 @@
 
 #include <QtCore/QDebug>
 #include <QtCore/QFile>
+#include <QtCore/QJsonArray>
 #include <QtCore/QJsonDocument>
 #include <QtCore/QJsonObject>
 #include <QtCore/QMutexLocker>
@@ -17,37 +18,71 @@ const QString kWebsocketCertPath = WEBSOCKET_CERT_PATH;
 const QString kMessageType = "type";
 const QString kPayload = "data";
 
+// Several queued messages are delivered as one frame of this type whose
+// payload is an array of the individual messages.
+const QString kMsgTypeBatch = "batch";
+
+// A client sends this (as a text message) to switch the connection to the
+// binary protocol mode. JSON text stays the default for old receivers.
+const QString kMsgTypeSetBinaryMode = "setBinaryMode";
+
+// Candidate batches queued while no client is connected are merged rather
+// than replaced (see queuePendingMessage).
+const QString kMsgTypeIceCandidates = "iceCandidates";
+
+// Hard cap on the pending queue. With the per-type coalescing this is only
+// ever reached if many distinct message types show up.
+const int kMaxPendingMessages = 32;
+
+// The binary frame layout is [1 byte type id][payload]. The payload is the
+// Qt binary-JSON serialization of {"data": <payload>}, which skips both
+// text rendering and text parsing. Message types missing from this table
+// fall back to a JSON text frame even for binary-mode clients.
+const char *kBinaryTypeNames[] = {
+    "",                    // 0 is reserved / invalid.
+    "sessionDescription",  // 1
+    "iceCandidate",        // 2
+    "iceCandidates",       // 3
+    "stats",               // 4
+    "trace",               // 5
+    "streamSuspended",     // 6
+    "streamResumed",       // 7
+    "batch",               // 8
+    "reset",               // 9
+    "getIceCandidates",    // 10
+    "getSessionDescription", // 11
+    "getTrace",            // 12
+    "getStats",            // 13
+};
+const quint8 kNumBinaryTypes =
+        sizeof(kBinaryTypeNames) / sizeof(kBinaryTypeNames[0]);
+
+quint8 binaryTypeId(const QString &type) {
+    for (quint8 i = 1; i < kNumBinaryTypes; ++i) {
+        if (type == kBinaryTypeNames[i]) {
+            return i;
+        }
+    }
+    return 0;
+}
+
 } // namespace
 
 WebsocketServer::WebsocketServer(quint16 port)
-    : m_websocket_server(new QWebSocketServer("PACC server",
-                                              QWebSocketServer::SecureMode))
+    : m_port(port)
+    , m_next_client_id(1)
 {
-    QSslConfiguration sslConfiguration;
-    QFile cert_file(kWebsocketCertPath + "/localhost.crt");
-    cert_file.open(QIODevice::ReadOnly);
-    QSslCertificate certificate(&cert_file, QSsl::Pem);
-    cert_file.close();
+}
 
-    QFile key_file(kWebsocketCertPath + "/localhost.key");
-    key_file.open(QIODevice::ReadOnly);
-    QSslKey ssl_key(&key_file, QSsl::Rsa, QSsl::Pem);
-    key_file.close();
+void WebsocketServer::start() {
+    Q_ASSERT(!m_websocket_server);
+    m_websocket_server.reset(new QWebSocketServer(
+                                 "PACC server", QWebSocketServer::SecureMode));
 
-    if (certificate.isNull() || ssl_key.isNull()) {
-        qCritical() << QString("The websocket certificate could not be loaded. "
-                               "Please verify that localhost.crt and "
-                               "localhost.key exist in %s and are readable by "
-                               "the pacc module.")
-                       .arg(kWebsocketCertPath);
-        exit(1);
+    if (m_ssl_configuration.isNull()) {
+        loadSslConfiguration();
     }
-
-    sslConfiguration.setPeerVerifyMode(QSslSocket::VerifyNone);
-    sslConfiguration.setLocalCertificate(certificate);
-    sslConfiguration.setPrivateKey(ssl_key);
-    sslConfiguration.setProtocol(QSsl::TlsV1SslV3);
-    m_websocket_server->setSslConfiguration(sslConfiguration);
+    m_websocket_server->setSslConfiguration(m_ssl_configuration);
 
     connect(m_websocket_server.data(), &QWebSocketServer::newConnection,
             this, &WebsocketServer::onNewConnection);
@@ -68,19 +103,59 @@ WebsocketServer::WebsocketServer(quint16 port)
         qWarning() << "PeerVerifyError: " << error.errorString();
     });
 
-    Q_ASSERT(m_websocket_server->listen(QHostAddress::Any, port) &&
+    Q_ASSERT(m_websocket_server->listen(QHostAddress::Any, m_port) &&
              "Could not start the websocket server");
 }
 
+void WebsocketServer::loadSslConfiguration() {
+    QFile cert_file(kWebsocketCertPath + "/localhost.crt");
+    cert_file.open(QIODevice::ReadOnly);
+    QSslCertificate certificate(&cert_file, QSsl::Pem);
+    cert_file.close();
+
+    QFile key_file(kWebsocketCertPath + "/localhost.key");
+    key_file.open(QIODevice::ReadOnly);
+    QSslKey ssl_key(&key_file, QSsl::Rsa, QSsl::Pem);
+    key_file.close();
+
+    if (certificate.isNull() || ssl_key.isNull()) {
+        qCritical() << QString("The websocket certificate could not be loaded. "
+                               "Please verify that localhost.crt and "
+                               "localhost.key exist in %s and are readable by "
+                               "the pacc module.")
+                       .arg(kWebsocketCertPath);
+        exit(1);
+    }
+
+    m_ssl_configuration.setPeerVerifyMode(QSslSocket::VerifyNone);
+    m_ssl_configuration.setLocalCertificate(certificate);
+    m_ssl_configuration.setPrivateKey(ssl_key);
+    m_ssl_configuration.setProtocol(QSsl::TlsV1SslV3);
+
+    // Enables TLS session resumption. Qt disables tickets and session
+    // sharing by default; with them on, a receiver roaming between APs
+    // resumes its session in one round trip instead of re-running the full
+    // RSA handshake on every reconnect.
+    m_ssl_configuration.setSslOption(QSsl::SslOptionDisableSessionTickets,
+                                     false);
+    m_ssl_configuration.setSslOption(QSsl::SslOptionDisableSessionSharing,
+                                     false);
+    m_ssl_configuration.setSslOption(
+                QSsl::SslOptionDisableSessionPersistence, false);
+}
+
 WebsocketServer::~WebsocketServer() {
+    QMutexLocker l(&m_socket_mutex);
+    qDeleteAll(m_sockets);
 }
 
 void WebsocketServer::onNewConnection() {
     QWebSocket *socket = m_websocket_server->nextPendingConnection();
 
-    QMutexLocker l(&m_socket_mutex);
     connect(socket, &QWebSocket::textMessageReceived,
             this, &WebsocketServer::processTextMessage);
+    connect(socket, &QWebSocket::binaryMessageReceived,
+            this, &WebsocketServer::processBinaryMessage);
     connect(socket, &QWebSocket::disconnected,
             this, &WebsocketServer::socketDisconnected);
     void (QWebSocket::*error)(QAbstractSocket::SocketError) =
@@ -89,46 +164,133 @@ void WebsocketServer::onNewConnection() {
         qWarning() << "onError" << QString::number(error);
     });
 
-    if (!m_socket.isNull()) {
-        qWarning() << "There is already a client connected!";
-    }
-    m_socket.reset(socket);
+    QMutexLocker l(&m_socket_mutex);
+    quintptr client_id = m_next_client_id++;
+    m_sockets.insert(client_id, socket);
+    m_client_ids.insert(socket, client_id);
 
-    // Sends all the pending messages.
-    while (!m_pending_messages.isEmpty()) {
-        const QString &pending_message = m_pending_messages.takeFirst();
-        m_socket->sendTextMessage(pending_message);
+    // Sends the pending broadcast messages to the new client, coalesced
+    // into one frame so the TLS layer does not emit a record per message.
+    if (!m_pending_messages.isEmpty()) {
+        QString message;
+        if (m_pending_messages.size() == 1) {
+            message = serializeMessage(m_pending_messages.first());
+        } else {
+            QJsonArray batch;
+            foreach (const QJsonObject &pending, m_pending_messages) {
+                batch.append(pending);
+            }
+            message = serializeMessage(makeMessage(kMsgTypeBatch, batch));
+        }
+        m_pending_messages.clear();
+        socket->sendTextMessage(message);
     }
 
-    emit clientConnected();
+    l.unlock();
+    emit clientConnected(client_id);
 }
 
-void WebsocketServer::sendMessage(const QString &type,
-                                  const QJsonValue &payload) {
-    // Assembles the message.
+QJsonObject WebsocketServer::makeMessage(const QString &type,
+                                         const QJsonValue &payload) {
     QJsonObject json_message;
     json_message[kMessageType] = type;
     json_message[kPayload] = payload;
+    return json_message;
+}
+
+QString WebsocketServer::serializeMessage(const QJsonObject &message) {
+    QJsonDocument document(message);
+    return QString::fromUtf8(document.toJson());
+}
 
-    QJsonDocument document(json_message);
-    QString message = QString::fromUtf8(document.toJson());
+void WebsocketServer::sendToSocket(QWebSocket *socket, quintptr client_id,
+                                   const QString &type,
+                                   const QJsonValue &payload) {
+    if (m_binary_clients.contains(client_id)) {
+        quint8 type_id = binaryTypeId(type);
+        if (type_id != 0) {
+            QJsonObject wrapper;
+            wrapper[kPayload] = payload;
 
-    // Sends the message if there is a socket connected or adds it to the
-    // pending queue.
+            QByteArray frame;
+            frame.append((char)type_id);
+            frame.append(QJsonDocument(wrapper).toBinaryData());
+            socket->sendBinaryMessage(frame);
+            return;
+        }
+        // Unknown type: falls through to the text frame.
+    }
+
+    socket->sendTextMessage(serializeMessage(makeMessage(type, payload)));
+}
+
+void WebsocketServer::sendMessage(const QString &type,
+                                  const QJsonValue &payload) {
+    // Broadcasts the message to all clients or adds it to the pending queue
+    // if none is connected.
     QMutexLocker l(&m_socket_mutex);
-    if (m_socket) {
-        m_socket->sendTextMessage(message);
+    if (!m_sockets.isEmpty()) {
+        for (QHash<quintptr, QWebSocket *>::const_iterator it =
+             m_sockets.constBegin(); it != m_sockets.constEnd(); ++it) {
+            sendToSocket(it.value(), it.key(), type, payload);
+        }
     } else {
-        m_pending_messages.append(message);
+        queuePendingMessage(type, payload);
+    }
+}
+
+void WebsocketServer::queuePendingMessage(const QString &type,
+                                          const QJsonValue &payload) {
+    // Coalesces by type: a stale stats snapshot or session description is
+    // useless once a newer one exists, so only the newest survives (moved to
+    // the back to keep rough ordering). Candidate batches are the exception
+    // and get merged, since every candidate matters.
+    QJsonValue queued_payload = payload;
+    for (int i = 0; i < m_pending_messages.size(); ++i) {
+        if (m_pending_messages.at(i)[kMessageType].toString() != type) {
+            continue;
+        }
+
+        if (type == kMsgTypeIceCandidates) {
+            QJsonArray merged = m_pending_messages.at(i)[kPayload].toArray();
+            foreach (const QJsonValue &candidate, payload.toArray()) {
+                merged.append(candidate);
+            }
+            queued_payload = merged;
+        }
+
+        m_pending_messages.removeAt(i);
+        break;
+    }
+
+    // Keeps the queue bounded even against unknown message types.
+    if (m_pending_messages.size() >= kMaxPendingMessages) {
+        m_pending_messages.removeFirst();
+    }
+
+    m_pending_messages.append(makeMessage(type, queued_payload));
+}
+
+void WebsocketServer::sendMessage(quintptr client_id, const QString &type,
+                                  const QJsonValue &payload) {
+    QMutexLocker l(&m_socket_mutex);
+    QWebSocket *socket = m_sockets.value(client_id, NULL);
+    if (!socket) {
+        qWarning() << "Dropping message for disconnected client" << client_id;
+        return;
     }
+    sendToSocket(socket, client_id, type, payload);
 }
 
 void WebsocketServer::processTextMessage(QString message) {
     QWebSocket *socket = qobject_cast<QWebSocket *>(sender());
 
-    // Checks if the socket matches.
-    if (socket != m_socket.data()) {
-        qWarning() << "Message from wrong socket. Ignoring.";
+    // Looks the client up.
+    QMutexLocker l(&m_socket_mutex);
+    quintptr client_id = m_client_ids.value(socket, 0);
+    l.unlock();
+    if (!client_id) {
+        qWarning() << "Message from unknown socket. Ignoring.";
         return;
     }
 
@@ -156,17 +318,70 @@ void WebsocketServer::processTextMessage(QString message) {
     const QString &type = msg_object[kMessageType].toString();
     const QJsonValue &payload = msg_object[kPayload];
 
-    emit messageReceived(type, payload);
+    // The protocol negotiation is handled here; everything else belongs to
+    // the subscribers. All frames sent after the acknowledgement arrives at
+    // the client are binary (for the types the table knows).
+    if (type == kMsgTypeSetBinaryMode) {
+        l.relock();
+        m_binary_clients.insert(client_id);
+        l.unlock();
+        sendMessage(client_id, kMsgTypeSetBinaryMode, true);
+        return;
+    }
+
+    emit messageReceived(client_id, type, payload);
+}
+
+void WebsocketServer::processBinaryMessage(QByteArray message) {
+    QWebSocket *socket = qobject_cast<QWebSocket *>(sender());
+
+    // Looks the client up.
+    QMutexLocker l(&m_socket_mutex);
+    quintptr client_id = m_client_ids.value(socket, 0);
+    l.unlock();
+    if (!client_id) {
+        qWarning() << "Message from unknown socket. Ignoring.";
+        return;
+    }
+
+    // Decodes the frame: [1 byte type id][binary JSON {"data": payload}].
+    if (message.size() < 1) {
+        qWarning() << "Invalid binary websocket message.";
+        return;
+    }
+    quint8 type_id = (quint8)message.at(0);
+    if (type_id == 0 || type_id >= kNumBinaryTypes) {
+        qWarning() << "Unknown binary message type" << type_id;
+        return;
+    }
+
+    QJsonValue payload;
+    if (message.size() > 1) {
+        QJsonDocument document =
+                QJsonDocument::fromBinaryData(message.mid(1));
+        if (!document.isObject()) {
+            qWarning() << "Invalid binary websocket message.";
+            return;
+        }
+        payload = document.object()[kPayload];
+    }
+
+    emit messageReceived(client_id, kBinaryTypeNames[type_id], payload);
 }
 
 void WebsocketServer::socketDisconnected() {
     QWebSocket *socket = qobject_cast<QWebSocket *>(sender());
+
     QMutexLocker l(&m_socket_mutex);
-    if (socket == m_socket.data()) {
-        m_socket.take();
+    quintptr client_id = m_client_ids.take(socket);
+    if (client_id) {
+        m_sockets.remove(client_id);
+        m_binary_clients.remove(client_id);
     }
     socket->deleteLater();
 
     l.unlock();
-    emit clientDisconnected();
+    if (client_id) {
+        emit clientDisconnected(client_id);
+    }
 }
@@ -1,10 +1,14 @@
 #ifndef WEBSOCKET_SERVER_H
 #define WEBSOCKET_SERVER_H
 
+#include <QtCore/QHash>
+#include <QtCore/QJsonObject>
+#include <QtCore/QList>
 #include <QtCore/QMutex>
 #include <QtCore/QScopedPointer>
+#include <QtCore/QSet>
 #include <QtCore/QString>
-#include <QtCore/QStringList>
+#include <QtNetwork/QSslConfiguration>
 
 #include "control_server.h"
 
@@ -15,22 +19,67 @@ class WebsocketServer : public ControlServer {
     Q_OBJECT
 
 public:
+    // The constructor is deliberately cheap; the certificate I/O, TLS setup
+    // and listen happen in start() so module load is not delayed by them.
     explicit WebsocketServer(quint16 port);
     virtual ~WebsocketServer();
 
     void sendMessage(const QString &type, const QJsonValue &payload) override;
+    void sendMessage(quintptr client_id, const QString &type,
+                     const QJsonValue &payload) override;
+
+public Q_SLOTS:
+    // Loads the certificate, builds the SSL configuration and starts
+    // listening. Messages sent before a client connects are queued either
+    // way, so early signaling is not lost.
+    void start();
 
 private Q_SLOTS:
     void onNewConnection();
     void processTextMessage(QString message);
+    void processBinaryMessage(QByteArray message);
     void socketDisconnected();
 
 private:
+    static QJsonObject makeMessage(const QString &type,
+                                   const QJsonValue &payload);
+    static QString serializeMessage(const QJsonObject &message);
+
+    // Sends in the client's negotiated mode: a compact binary frame when the
+    // client opted in via setBinaryMode, the JSON text frame otherwise.
+    void sendToSocket(QWebSocket *socket, quintptr client_id,
+                      const QString &type, const QJsonValue &payload);
+
+    // Queues a broadcast for the next client, coalescing by message type so
+    // the queue stays bounded no matter how long no receiver is around.
+    void queuePendingMessage(const QString &type, const QJsonValue &payload);
+
+    // Parses the certificate and key once and builds the warm TLS context
+    // every connection shares (see m_ssl_configuration).
+    void loadSslConfiguration();
+
+    quint16 m_port;
     QScopedPointer<QWebSocketServer> m_websocket_server;
 
+    // The pre-parsed certificate/key context with session resumption
+    // enabled. Built exactly once; the PEM files are never re-read and
+    // reconnecting clients resume their TLS session instead of paying a
+    // full RSA handshake.
+    QSslConfiguration m_ssl_configuration;
+
     QMutex m_socket_mutex;
-    QScopedPointer<QWebSocket> m_socket;
-    QStringList m_pending_messages;
+    QHash<quintptr, QWebSocket *> m_sockets;
+    QHash<QWebSocket *, quintptr> m_client_ids;
+    quintptr m_next_client_id;
+
+    // Clients that negotiated the binary protocol mode.
+    QSet<quintptr> m_binary_clients;
+
+    // Broadcasts produced while no client is connected, at most one entry
+    // per message type (candidate batches are merged, everything else keeps
+    // only the newest message). Delivered as a single batch frame when the
+    // first client shows up.
+    QList<QJsonObject> m_pending_messages;
 };
 
 
@@ -4,14 +4,46 @@
 extern "C" {
 #include <config.h>
 #include <pulse/sample.h>
+#include <pulsecore/memchunk.h>
 } // extern "C"
 
 class Writer {
 public:
     virtual ~Writer() {}
 
+    // The writer's native format: what write() consumes without conversion.
     virtual pa_sample_format_t sampleFormat() const =0;
+
+    // Whether the sink may deliver blocks in the given format. Writers
+    // accept formats beyond the native one when they can convert whole
+    // blocks internally (see BaseWriter).
+    virtual bool acceptsSampleFormat(pa_sample_format_t format) const =0;
+
+    // Tells the writer which of the accepted formats the sink settled on.
+    // Called once from PASinkPriv::init before any block is delivered.
+    virtual void setDeliveredSampleFormat(pa_sample_format_t format) =0;
+
+    // Whether the writer can handle the given sample rate. Checked against
+    // the rate modarg in PASinkPriv::init before the sink goes live, so a
+    // rate the writer cannot serve fails loudly instead of producing a
+    // silently dead stream.
+    virtual bool acceptsSampleRate(int rate_hz) const =0;
+
     virtual ssize_t write(const void *buf, size_t length) =0;
+
+    // Takes back up to nbytes of delivered-but-unsent audio, newest first,
+    // and returns the number of bytes reclaimed; both counts are in the
+    // delivered format. The sink only re-renders what was reclaimed here,
+    // so an edit (volume change, track skip) becomes audible after the
+    // network depth instead of the full buffer depth (see
+    // PASinkPriv::processRewind). Called from the sink thread.
+    virtual size_t rewind(size_t nbytes) =0;
+
+    // Zero-copy variant: hands over a reference to the rendered memchunk.
+    // Writers that can consume the memblock in place keep a reference to it
+    // and thereby avoid one full copy per block; others fall back to the
+    // contiguous write() above (see BaseWriter).
+    virtual ssize_t write(const pa_memchunk *chunk) =0;
 };
 
 #endif // WRITER_H
@@ -1,9 +1,24 @@
 #include "writer_base.h"
 
 #include "pa_sink.h"
+#include "sample_ops.h"
+
+namespace {
+// Returns the other half of the s16/float conversion pair, or
+// PA_SAMPLE_INVALID if there is no kernel for the given format.
+pa_sample_format_t conversionPartner(pa_sample_format_t format) {
+    switch (format) {
+        case PA_SAMPLE_S16LE:     return PA_SAMPLE_FLOAT32LE;
+        case PA_SAMPLE_FLOAT32LE: return PA_SAMPLE_S16LE;
+
+        default: return PA_SAMPLE_INVALID;
+    }
+}
+} // namespace
 
 BaseWriter::BaseWriter(PASink *pa_sink)
     : m_pa_sink(pa_sink)
+    , m_delivered_format(PA_SAMPLE_INVALID)
 {
 }
 
@@ -11,3 +26,80 @@ PASink *BaseWriter::pa_sink() const {
     return m_pa_sink;
 }
 
+bool BaseWriter::acceptsSampleFormat(pa_sample_format_t format) const {
+    return format == sampleFormat() ||
+            format == conversionPartner(sampleFormat());
+}
+
+void BaseWriter::setDeliveredSampleFormat(pa_sample_format_t format) {
+    Q_ASSERT(acceptsSampleFormat(format));
+    m_delivered_format = format;
+}
+
+bool BaseWriter::acceptsSampleRate(int rate_hz) const {
+    Q_UNUSED(rate_hz);
+    return true;
+}
+
+size_t BaseWriter::rewind(size_t nbytes) {
+    const pa_sample_format_t native = sampleFormat();
+    const bool convert = m_delivered_format != PA_SAMPLE_INVALID &&
+            m_delivered_format != native;
+    if (!convert) {
+        return rewindNative(nbytes);
+    }
+
+    // The hand-off buffers hold native-format bytes; the same span of
+    // audio differs in size by the sample-size ratio.
+    const size_t native_size = pa_sample_size_of_format(native);
+    const size_t delivered_size = pa_sample_size_of_format(m_delivered_format);
+    size_t reclaimed = rewindNative(nbytes / delivered_size * native_size);
+    return reclaimed / native_size * delivered_size;
+}
+
+size_t BaseWriter::rewindNative(size_t length) {
+    Q_UNUSED(length);
+    return 0;
+}
+
+ssize_t BaseWriter::write(const pa_memchunk *chunk) {
+    const pa_sample_format_t native = sampleFormat();
+    const bool convert = m_delivered_format != PA_SAMPLE_INVALID &&
+            m_delivered_format != native;
+
+    void *p = pa_memblock_acquire(chunk->memblock);
+    const uint8_t *bytes = (const uint8_t *)p + chunk->index;
+
+    ssize_t bytes_written;
+    if (!convert) {
+        bytes_written = write(bytes, chunk->length);
+    } else if (m_delivered_format == PA_SAMPLE_FLOAT32LE) {
+        // float -> s16 on the whole block; half the bytes come out.
+        size_t num_samples = chunk->length / sizeof(float);
+        m_convert_buffer.resize((int)(num_samples * sizeof(int16_t)));
+        sample_ops::floatToS16((const float *)bytes,
+                               (int16_t *)m_convert_buffer.data(),
+                               num_samples);
+        bytes_written = write(m_convert_buffer.constData(),
+                              num_samples * sizeof(int16_t));
+        if (bytes_written >= 0) {
+            bytes_written = chunk->length;
+        }
+    } else {
+        // s16 -> float on the whole block; twice the bytes come out.
+        size_t num_samples = chunk->length / sizeof(int16_t);
+        m_convert_buffer.resize((int)(num_samples * sizeof(float)));
+        sample_ops::s16ToFloat((const int16_t *)bytes,
+                               (float *)m_convert_buffer.data(),
+                               num_samples);
+        bytes_written = write(m_convert_buffer.constData(),
+                              num_samples * sizeof(float));
+        if (bytes_written >= 0) {
+            bytes_written = chunk->length;
+        }
+    }
+    pa_memblock_release(chunk->memblock);
+
+    return bytes_written;
+}
+
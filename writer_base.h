@@ -1,6 +1,8 @@
 #ifndef WRITER_BASE_H
 #define WRITER_BASE_H
 
+#include <QtCore/QByteArray>
+
 #include "writer.h"
 
 class PASink;
@@ -9,11 +11,41 @@ class BaseWriter : public Writer {
 public:
     PASink *pa_sink() const;
 
+    // Accepts the native format plus the other half of the s16/float pair,
+    // for which vectorized conversion kernels exist (see sample_ops).
+    bool acceptsSampleFormat(pa_sample_format_t format) const override;
+    void setDeliveredSampleFormat(pa_sample_format_t format) override;
+
+    // Accepts every PA-valid rate; writers with codec constraints narrow
+    // this down (see OpusWriter).
+    bool acceptsSampleRate(int rate_hz) const override;
+
+    // Copying fallback for the zero-copy interface: acquires the memblock,
+    // converts the whole block to the native format if the sink delivers
+    // the other one, and forwards the contiguous bytes to
+    // write(const void *, size_t).
+    ssize_t write(const pa_memchunk *chunk) override;
+    using Writer::write;
+
+    // Maps the delivered-format byte counts through the conversion ratio
+    // and delegates the actual reclaim to rewindNative().
+    size_t rewind(size_t nbytes) override;
+
 protected:
     explicit BaseWriter(PASink *pa_sink);
 
+    // Reclaims up to length bytes of native-format audio from the writer's
+    // hand-off buffer, newest first, and returns the number reclaimed. The
+    // default cannot take anything back.
+    virtual size_t rewindNative(size_t length);
+
 private:
     PASink *m_pa_sink;
+    pa_sample_format_t m_delivered_format;
+
+    // Scratch space for the format conversion. Only touched from the sink
+    // thread; grows to one block and stays there.
+    QByteArray m_convert_buffer;
 };
 
 #endif // WRITER_BASE_H
@@ -0,0 +1,307 @@
+#include "writer_http.h"
+
+#include <atomic>
+#include <cstring>
+
+#include <QtCore/QByteArray>
+#include <QtCore/QDebug>
+#include <QtCore/QHash>
+#include <QtCore/QScopedArrayPointer>
+#include <QtCore/QTimer>
+#include <QtNetwork/QHostAddress>
+#include <QtNetwork/QTcpServer>
+#include <QtNetwork/QTcpSocket>
+
+#include "pa_sink.h"
+#include "stats.h"
+
+namespace {
+const pa_sample_format_t kSampleFormat = PA_SAMPLE_S16LE;
+
+// How much audio the broadcast ring holds. Listeners lagging further than
+// this get skipped forward.
+const int kRingCapacitySec = 2;
+
+// How often the pending audio is flushed to the listeners. 20 ms keeps the
+// added latency marginal while batching enough bytes per send.
+const int kFlushIntervalMsec = 20;
+
+// A listener that lags by more than half the ring is skipped forward to
+// this far behind the producer.
+const int kResyncLagDivisor = 4;
+} // namespace
+
+// A single-producer broadcast ring: the sink thread appends, every listener
+// reads at its own offset directly out of the ring memory. The producer
+// never blocks and simply overwrites the oldest audio; readers detect the
+// overrun via their lag and resynchronize.
+class BroadcastRing {
+public:
+    explicit BroadcastRing(size_t capacity)
+        : m_write_pos(0)
+    {
+        m_capacity = 1;
+        while (m_capacity < capacity) {
+            m_capacity <<= 1;
+        }
+        m_data.reset(new char[m_capacity]);
+    }
+
+    size_t capacity() const {
+        return m_capacity;
+    }
+
+    size_t writePos() const {
+        return m_write_pos.load(std::memory_order_acquire);
+    }
+
+    // Appends unconditionally. Must only be called from the producer thread.
+    void write(const void *buf, size_t length) {
+        size_t write_pos = m_write_pos.load(std::memory_order_relaxed);
+        size_t offset = write_pos & (m_capacity - 1);
+        size_t tail = m_capacity - offset;
+        if (length <= tail) {
+            memcpy(m_data.data() + offset, buf, length);
+        } else {
+            memcpy(m_data.data() + offset, buf, tail);
+            memcpy(m_data.data(), (const char *)buf + tail, length - tail);
+        }
+        m_write_pos.store(write_pos + length, std::memory_order_release);
+    }
+
+    // Takes back up to length of the most recently appended bytes and
+    // returns the number reclaimed. Must only be called from the producer
+    // thread. Audio a flush already pushed into a socket cannot be
+    // unsent; such a listener simply waits until the producer writes past
+    // its position again (see HttpStreamServer::flush).
+    size_t unwrite(size_t length) {
+        size_t write_pos = m_write_pos.load(std::memory_order_relaxed);
+        if (length > write_pos) {
+            length = write_pos;
+        }
+        m_write_pos.store(write_pos - length, std::memory_order_release);
+        return length;
+    }
+
+    // Returns up to two contiguous segments covering [pos, pos + length).
+    // The pointers alias the ring memory; the caller must consume them
+    // before the producer laps the ring.
+    int segments(size_t pos, size_t length,
+                 const char **seg0, size_t *len0,
+                 const char **seg1, size_t *len1) const {
+        size_t offset = pos & (m_capacity - 1);
+        size_t tail = m_capacity - offset;
+        if (length <= tail) {
+            *seg0 = m_data.data() + offset;
+            *len0 = length;
+            return 1;
+        }
+        *seg0 = m_data.data() + offset;
+        *len0 = tail;
+        *seg1 = m_data.data();
+        *len1 = length - tail;
+        return 2;
+    }
+
+private:
+    Q_DISABLE_COPY(BroadcastRing)
+
+    QScopedArrayPointer<char> m_data;
+    size_t m_capacity;
+    std::atomic<size_t> m_write_pos;
+};
+
+// Accepts listener connections, answers the HTTP/ICY request and pumps the
+// broadcast ring into every established stream. Lives on the Qt main
+// thread; only the ring is shared with the sink thread.
+class HttpStreamServer : public QObject {
+public:
+    HttpStreamServer(BroadcastRing *ring, PASink *pa_sink, quint16 port)
+        : m_ring(ring)
+        , m_pa_sink(pa_sink)
+    {
+        connect(&m_server, &QTcpServer::newConnection, [this]() {
+            onNewConnection();
+        });
+        if (!m_server.listen(QHostAddress::Any, port)) {
+            qCritical() << "Could not start the http stream server on port"
+                        << port;
+        }
+
+        QTimer *flush_timer = new QTimer(this);
+        connect(flush_timer, &QTimer::timeout, [this]() {
+            flush();
+        });
+        flush_timer->start(kFlushIntervalMsec);
+    }
+
+private:
+    void onNewConnection() {
+        QTcpSocket *socket = m_server.nextPendingConnection();
+        connect(socket, &QTcpSocket::disconnected, [this, socket]() {
+            m_listeners.remove(socket);
+            socket->deleteLater();
+        });
+        connect(socket, &QTcpSocket::readyRead, [this, socket]() {
+            onRequestData(socket);
+        });
+    }
+
+    void onRequestData(QTcpSocket *socket) {
+        if (m_listeners.contains(socket)) {
+            // Already streaming; drains and ignores whatever else arrives.
+            socket->readAll();
+            return;
+        }
+
+        m_requests[socket].append(socket->readAll());
+        if (!m_requests[socket].contains("\r\n\r\n")) {
+            return; // The request head is not complete yet.
+        }
+        m_requests.remove(socket);
+
+        // Any GET gets the one stream; the request target is irrelevant.
+        socket->write("HTTP/1.1 200 OK\r\n"
+                      "Content-Type: audio/wav\r\n"
+                      "Transfer-Encoding: chunked\r\n"
+                      "Connection: close\r\n"
+                      "Cache-Control: no-cache\r\n"
+                      "icy-name: PACC\r\n"
+                      "\r\n");
+        sendChunk(socket, wavHeader().constData(), wavHeader().size(), NULL,
+                  0);
+
+        // New listeners start at the live edge.
+        m_listeners.insert(socket, m_ring->writePos());
+    }
+
+    // Streams a WAV head with maxed-out sizes; receivers treat it as a
+    // stream of unknown length.
+    const QByteArray &wavHeader() {
+        if (m_wav_header.isEmpty()) {
+            const quint32 rate = m_pa_sink->sampleRateHz();
+            const quint16 channels = m_pa_sink->numChannels();
+            const quint16 bytes_per_frame = channels * 2;
+
+            struct {
+                char riff[4]; quint32 riff_size; char wave[4];
+                char fmt[4]; quint32 fmt_size; quint16 format;
+                quint16 channels; quint32 rate; quint32 byte_rate;
+                quint16 block_align; quint16 bits; char data[4];
+                quint32 data_size;
+            } __attribute__((packed)) header;
+
+            memcpy(header.riff, "RIFF", 4);
+            header.riff_size = 0xFFFFFFFF;
+            memcpy(header.wave, "WAVE", 4);
+            memcpy(header.fmt, "fmt ", 4);
+            header.fmt_size = 16;
+            header.format = 1; // PCM
+            header.channels = channels;
+            header.rate = rate;
+            header.byte_rate = rate * bytes_per_frame;
+            header.block_align = bytes_per_frame;
+            header.bits = 16;
+            memcpy(header.data, "data", 4);
+            header.data_size = 0xFFFFFFFF;
+
+            m_wav_header = QByteArray((const char *)&header, sizeof(header));
+        }
+        return m_wav_header;
+    }
+
+    // Sends one HTTP chunk assembled from up to two ring segments. The
+    // payload goes straight from the ring memory into the socket, so the
+    // per-listener cost is the kernel send and nothing else.
+    static void sendChunk(QTcpSocket *socket, const char *seg0, size_t len0,
+                          const char *seg1, size_t len1) {
+        QByteArray size_line =
+                QByteArray::number((qulonglong)(len0 + len1), 16) + "\r\n";
+        socket->write(size_line);
+        socket->write(seg0, len0);
+        if (seg1) {
+            socket->write(seg1, len1);
+        }
+        socket->write("\r\n");
+    }
+
+    void flush() {
+        if (m_listeners.isEmpty()) {
+            return;
+        }
+
+        size_t write_pos = m_ring->writePos();
+        for (QHash<QTcpSocket *, size_t>::iterator it = m_listeners.begin();
+             it != m_listeners.end(); ++it) {
+            // A rewind may have pulled the producer behind this listener;
+            // the signed difference skips it until new audio arrives so the
+            // already-sent span is never delivered twice.
+            if ((qint64)(write_pos - it.value()) <= 0) {
+                continue;
+            }
+            size_t lag = write_pos - it.value();
+
+            // Skips listeners that fell too far behind; reading that close
+            // to the producer would race with the overwrite.
+            if (lag > m_ring->capacity() / 2) {
+                it.value() = write_pos -
+                        m_ring->capacity() / kResyncLagDivisor;
+                lag = write_pos - it.value();
+            }
+
+            const char *seg0 = NULL;
+            const char *seg1 = NULL;
+            size_t len0 = 0;
+            size_t len1 = 0;
+            m_ring->segments(it.value(), lag, &seg0, &len0, &seg1, &len1);
+            sendChunk(it.key(), seg0, len0, seg1, len1);
+
+            it.value() = write_pos;
+        }
+    }
+
+    BroadcastRing *m_ring;
+    PASink *m_pa_sink;
+    QTcpServer m_server;
+
+    // Listener socket -> its read position in the ring.
+    QHash<QTcpSocket *, size_t> m_listeners;
+    QHash<QTcpSocket *, QByteArray> m_requests;
+    QByteArray m_wav_header;
+};
+
+class HttpWriterPriv {
+public:
+    QScopedPointer<BroadcastRing> ring;
+    QScopedPointer<HttpStreamServer> server;
+};
+
+HttpWriter::HttpWriter(PASink *pa_sink, quint16 http_port)
+    : BaseWriter(pa_sink)
+    , d(new HttpWriterPriv)
+{
+    size_t byte_rate = pa_sink->sampleRateHz() * pa_sink->numChannels() *
+            pa_sample_size_of_format(kSampleFormat);
+    d->ring.reset(new BroadcastRing(kRingCapacitySec * byte_rate));
+    d->server.reset(new HttpStreamServer(d->ring.data(), pa_sink, http_port));
+}
+
+HttpWriter::~HttpWriter() {
+}
+
+pa_sample_format_t HttpWriter::sampleFormat() const {
+    return kSampleFormat;
+}
+
+ssize_t HttpWriter::write(const void *buf, size_t length) {
+    // Appends without ever blocking; listeners that cannot keep up are
+    // resynchronized by the server instead of stalling the sink thread.
+    d->ring->write(buf, length);
+    stats::counters().delivered_blocks.fetch_add(1,
+                                                 std::memory_order_relaxed);
+    return length;
+}
+
+size_t HttpWriter::rewindNative(size_t length) {
+    return d->ring->unwrite(length);
+}
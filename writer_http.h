@@ -0,0 +1,32 @@
+#ifndef WRITER_HTTP_H
+#define WRITER_HTTP_H
+
+#include <QtCore/QScopedPointer>
+
+#include "writer_base.h"
+
+class HttpWriterPriv;
+
+// Serves the rendered PCM as a chunked HTTP/ICY WAV stream for receivers
+// that do not speak WebRTC (Chromecast's default media receiver,
+// Sonos/Icecast-style clients). All listeners are fed from one shared
+// broadcast ring with per-listener read offsets, so an additional listener
+// costs no additional copies of the audio. Selected with writer=http; the
+// stream is served on http_port.
+class HttpWriter : public BaseWriter {
+public:
+    HttpWriter(PASink *pa_sink, quint16 http_port);
+    virtual ~HttpWriter();
+
+    pa_sample_format_t sampleFormat() const override;
+    ssize_t write(const void *buf, size_t length) override;
+    using BaseWriter::write;
+
+protected:
+    size_t rewindNative(size_t length) override;
+
+private:
+    QScopedPointer<HttpWriterPriv> d;
+};
+
+#endif // WRITER_HTTP_H
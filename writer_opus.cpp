@@ -0,0 +1,392 @@
+#include "writer_opus.h"
+
+#include <atomic>
+#include <cstring>
+
+#include <opus/opus.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <QtCore/QByteArray>
+#include <QtCore/QDateTime>
+#include <QtCore/QDebug>
+#include <QtCore/QSemaphore>
+#include <QtCore/QThread>
+#include <QtCore/QUuid>
+#include <QtNetwork/QHostAddress>
+#include <QtNetwork/QHostInfo>
+
+#include "encode_pool.h"
+#include "pa_sink.h"
+#include "spsc_ring_buffer.h"
+#include "stats.h"
+#include "thread_config.h"
+
+namespace {
+const pa_sample_format_t kSampleFormat = PA_SAMPLE_S16LE;
+
+// How much audio the hand-off ring between the sink thread and the
+// dispatch thread can hold.
+const int kRingCapacitySec = 2;
+
+// How much audio each peer's PCM ring buffers while its encode job waits
+// for a pool worker. Overflow is dropped per peer, so one stuck peer never
+// backs up into the shared ring.
+const int kPeerRingCapacityMsec = 500;
+
+// Opus frame duration. 20 ms is the codec's sweet spot between quality,
+// overhead and latency.
+const int kFrameMsec = 20;
+
+// RTP framing: dynamic payload type as commonly mapped for Opus.
+const quint8 kRtpPayloadType = 96;
+const int kRtpHeaderBytes = 12;
+const int kMaxPacketBytes = 1500;
+
+// Upper bound for the encode pool. "Small" is the point: the pool exists
+// to spread independent peer encodes over the spare cores, not to own the
+// machine.
+const int kMaxEncodeThreads = 4;
+} // namespace
+
+// One RTP receiver: its own encoder state, RTP numbering and pending-PCM
+// ring. The scheduled flag guarantees that at most one pool worker runs a
+// peer at a time, which keeps the stateful encoder and the RTP sequence
+// serial; the acquire/release pair on it also orders the ring hand-over
+// between successive workers.
+class PeerStream {
+public:
+    PeerStream(const OpusWriter::Destination &destination, int sample_rate,
+               int channels, size_t ring_capacity, int initial_bitrate)
+        : ring(ring_capacity)
+        , encoder(NULL)
+        , fd(-1)
+        , sequence(0)
+        , bitrate(initial_bitrate)
+        , scheduled(false)
+    {
+        // A plain UDP socket: encode jobs run on whatever pool thread is
+        // free, which rules out a thread-affine QUdpSocket.
+        fd = ::socket(AF_INET, SOCK_DGRAM, 0);
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(destination.port);
+
+        // rtp_host entries may be literals or names. A name parsed as a
+        // literal yields the null address and would silently stream to
+        // 0.0.0.0, so names are resolved explicitly; this runs once at
+        // module setup, where the blocking lookup is fine.
+        QHostAddress host(destination.host);
+        if (host.isNull()) {
+            foreach (const QHostAddress &candidate,
+                     QHostInfo::fromName(destination.host).addresses()) {
+                if (candidate.protocol() == QAbstractSocket::IPv4Protocol) {
+                    host = candidate;
+                    break;
+                }
+            }
+        }
+        if (host.protocol() != QAbstractSocket::IPv4Protocol) {
+            // Leaves the peer dead (no encoder), like a failed encoder
+            // setup; the other destinations keep streaming.
+            qCritical() << "Failed to resolve RTP destination"
+                        << destination.host;
+        } else {
+            addr.sin_addr.s_addr = htonl(host.toIPv4Address());
+
+            int error = OPUS_OK;
+            encoder = opus_encoder_create(sample_rate, channels,
+                                          OPUS_APPLICATION_AUDIO, &error);
+            if (error != OPUS_OK) {
+                qCritical() << "Failed to create the Opus encoder:"
+                            << opus_strerror(error);
+                encoder = NULL;
+            } else {
+                opus_encoder_ctl(encoder, OPUS_SET_BITRATE(bitrate));
+            }
+        }
+
+        timestamp = (quint32)QDateTime::currentMSecsSinceEpoch();
+
+        // Random per peer: all destinations are constructed within the
+        // same millisecond, so anything clock-derived would hand every
+        // stream the same SSRC; RFC 3550 wants them unique.
+        ssrc = QUuid::createUuid().data1;
+
+        pcm.resize(0); // Sized by the writer once the frame size is known.
+    }
+
+    ~PeerStream() {
+        if (encoder) {
+            opus_encoder_destroy(encoder);
+        }
+        if (fd >= 0) {
+            ::close(fd);
+        }
+    }
+
+    SpscRingBuffer ring;
+
+    OpusEncoder *encoder;
+    int fd;
+    struct sockaddr_in addr;
+
+    quint16 sequence;
+    quint32 timestamp;
+    quint32 ssrc;
+    opus_int32 bitrate;
+
+    QByteArray pcm;
+    unsigned char packet[kMaxPacketBytes];
+
+    std::atomic<bool> scheduled;
+
+private:
+    Q_DISABLE_COPY(PeerStream)
+};
+
+namespace {
+// Drains one peer's PCM ring: encode, frame, send. Runs on a pool worker;
+// the scheduled flag has been taken by the scheduler, so this job owns the
+// peer until it stores the flag back.
+void encodePeer(PeerStream *peer, PASink *pa_sink, int samples_per_channel,
+                size_t frame_bytes) {
+    for (;;) {
+        while (peer->encoder &&
+                peer->ring.availableForRead() >= frame_bytes) {
+            peer->ring.read(peer->pcm.data(), frame_bytes);
+
+            // Picks up the adaptive bitrate target; a changed value
+            // applies from the next encoded frame on.
+            opus_int32 target = pa_sink->bitRateBps();
+            if (target != peer->bitrate) {
+                peer->bitrate = target;
+                opus_encoder_ctl(peer->encoder, OPUS_SET_BITRATE(target));
+            }
+
+            opus_int32 encoded = opus_encode(
+                        peer->encoder,
+                        (const opus_int16 *)peer->pcm.constData(),
+                        samples_per_channel,
+                        peer->packet + kRtpHeaderBytes,
+                        kMaxPacketBytes - kRtpHeaderBytes);
+            if (encoded < 0) {
+                qWarning() << "Opus encode failed:"
+                           << opus_strerror(encoded);
+                stats::counters().deliver_failures.fetch_add(
+                            1, std::memory_order_relaxed);
+                continue;
+            }
+
+            // Assembles the RTP header (RFC 3550).
+            unsigned char *packet = peer->packet;
+            packet[0] = 0x80; // Version 2, no padding/extension/CSRC.
+            packet[1] = kRtpPayloadType;
+            packet[2] = (unsigned char)(peer->sequence >> 8);
+            packet[3] = (unsigned char)peer->sequence;
+            packet[4] = (unsigned char)(peer->timestamp >> 24);
+            packet[5] = (unsigned char)(peer->timestamp >> 16);
+            packet[6] = (unsigned char)(peer->timestamp >> 8);
+            packet[7] = (unsigned char)peer->timestamp;
+            packet[8] = (unsigned char)(peer->ssrc >> 24);
+            packet[9] = (unsigned char)(peer->ssrc >> 16);
+            packet[10] = (unsigned char)(peer->ssrc >> 8);
+            packet[11] = (unsigned char)peer->ssrc;
+
+            ::sendto(peer->fd, packet, kRtpHeaderBytes + encoded, 0,
+                     (const struct sockaddr *)&peer->addr,
+                     sizeof(peer->addr));
+
+            ++peer->sequence;
+            peer->timestamp += samples_per_channel;
+            stats::counters().delivered_blocks.fetch_add(
+                        1, std::memory_order_relaxed);
+        }
+
+        // Releases the peer. If the dispatcher slipped more frames in
+        // after the drain, re-take it right away so the wakeup is not
+        // lost; otherwise the dispatcher schedules a fresh job.
+        peer->scheduled.store(false, std::memory_order_release);
+        if (peer->ring.availableForRead() < frame_bytes ||
+                peer->scheduled.exchange(true,
+                                         std::memory_order_acq_rel)) {
+            return;
+        }
+    }
+}
+} // namespace
+
+// Pulls PCM frames from the hand-off ring and fans them out to the peers'
+// rings, scheduling an encode job for every peer that is not already
+// running. Runs on its own thread so the real-time sink thread never waits
+// for the fan-out copies.
+class OpusDispatchThread : public QThread {
+public:
+    OpusDispatchThread(SpscRingBuffer *ring, EncodePool *pool,
+                       const QList<PeerStream *> &peers, PASink *pa_sink)
+        : m_ring(ring)
+        , m_pool(pool)
+        , m_peers(peers)
+        , m_pa_sink(pa_sink)
+        , m_stopping(false)
+    {
+    }
+
+    // Called by the producer after it wrote to the ring.
+    void notify() {
+        m_available.release();
+    }
+
+    void stop() {
+        m_stopping.store(true, std::memory_order_release);
+        m_available.release();
+        wait();
+    }
+
+protected:
+    void run() override {
+        thread_config::applyToCurrentThread("pacc-opus");
+
+        const int samples_per_channel =
+                m_pa_sink->sampleRateHz() * kFrameMsec / 1000;
+        const size_t frame_bytes = samples_per_channel *
+                m_pa_sink->numChannels() * sizeof(opus_int16);
+
+        QByteArray pcm;
+        pcm.resize(frame_bytes);
+
+        PASink *pa_sink = m_pa_sink;
+
+        for (;;) {
+            m_available.acquire();
+            if (m_stopping.load(std::memory_order_acquire)) {
+                break;
+            }
+
+            while (m_ring->availableForRead() >= frame_bytes) {
+                m_ring->read(pcm.data(), frame_bytes);
+
+                foreach (PeerStream *peer, m_peers) {
+                    // Whole frames only: a partial write would shift every
+                    // later frame_bytes read in encodePeer off the frame
+                    // boundary for good. availableForWrite is exact here,
+                    // on the only producer of the peer ring.
+                    if (peer->ring.availableForWrite() >= frame_bytes) {
+                        peer->ring.write(pcm.constData(), frame_bytes);
+                    } else {
+                        stats::counters().dropped_bytes.fetch_add(
+                                    frame_bytes,
+                                    std::memory_order_relaxed);
+                    }
+
+                    if (!peer->scheduled.exchange(
+                                true, std::memory_order_acq_rel)) {
+                        m_pool->post([=]() {
+                            encodePeer(peer, pa_sink, samples_per_channel,
+                                       frame_bytes);
+                        });
+                    }
+                }
+            }
+        }
+    }
+
+private:
+    SpscRingBuffer *m_ring;
+    EncodePool *m_pool;
+    QList<PeerStream *> m_peers;
+    PASink *m_pa_sink;
+
+    QSemaphore m_available;
+    std::atomic<bool> m_stopping;
+};
+
+class OpusWriterPriv {
+public:
+    // The rate the encoder states were created at.
+    int sample_rate;
+
+    QScopedPointer<SpscRingBuffer> ring;
+    QScopedPointer<EncodePool> pool;
+    QList<PeerStream *> peers;
+    QScopedPointer<OpusDispatchThread> dispatch_thread;
+};
+
+OpusWriter::OpusWriter(PASink *pa_sink,
+                       const QList<Destination> &destinations)
+    : BaseWriter(pa_sink)
+    , d(new OpusWriterPriv)
+{
+    const int sample_rate = pa_sink->sampleRateHz();
+    const int channels = pa_sink->numChannels();
+    d->sample_rate = sample_rate;
+    const size_t byte_rate = sample_rate * channels *
+            pa_sample_size_of_format(kSampleFormat);
+    const size_t frame_bytes =
+            (sample_rate * kFrameMsec / 1000) * channels *
+            sizeof(opus_int16);
+
+    d->ring.reset(new SpscRingBuffer(kRingCapacitySec * byte_rate));
+
+    // Enough workers to run the peers in parallel, leaving a core for the
+    // sink thread.
+    int num_threads = qMin(destinations.size(),
+                           qMax(1, QThread::idealThreadCount() - 1));
+    num_threads = qBound(1, num_threads, kMaxEncodeThreads);
+    d->pool.reset(new EncodePool(num_threads));
+
+    const size_t peer_ring_bytes =
+            byte_rate * kPeerRingCapacityMsec / 1000;
+    foreach (const Destination &destination, destinations) {
+        PeerStream *peer = new PeerStream(destination, sample_rate,
+                                          channels, peer_ring_bytes,
+                                          pa_sink->bitRateBps());
+        peer->pcm.resize(frame_bytes);
+        d->peers.append(peer);
+    }
+
+    d->dispatch_thread.reset(new OpusDispatchThread(d->ring.data(),
+                                                    d->pool.data(),
+                                                    d->peers, pa_sink));
+    d->dispatch_thread->start();
+}
+
+OpusWriter::~OpusWriter() {
+    d->dispatch_thread->stop();
+
+    // Joins the workers before the peers they reference go away.
+    d->pool.reset();
+
+    qDeleteAll(d->peers);
+}
+
+pa_sample_format_t OpusWriter::sampleFormat() const {
+    return kSampleFormat;
+}
+
+bool OpusWriter::acceptsSampleRate(int rate_hz) const {
+    return rate_hz == d->sample_rate;
+}
+
+ssize_t OpusWriter::write(const void *buf, size_t length) {
+    // Hands the block over to the dispatch thread without ever blocking.
+    // Should the ring be full the overflow is dropped; stalling the
+    // real-time sink thread would be worse than losing some audio.
+    size_t written = d->ring->write(buf, length);
+    if (written < length) {
+        stats::counters().dropped_bytes.fetch_add(
+                    length - written, std::memory_order_relaxed);
+    }
+    d->dispatch_thread->notify();
+    return length;
+}
+
+size_t OpusWriter::rewindNative(size_t length) {
+    // Reclaims from the hand-off ring. Frames already fanned out to the
+    // per-peer rings are scheduled for encoding and stay; they cover at
+    // most the brief window until a pool worker picks the peer up.
+    return d->ring->unwrite(length);
+}